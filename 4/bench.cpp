@@ -0,0 +1,240 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <filesystem>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <unistd.h>
+
+#include "core/monitor.h"
+#include "utils/utils.h"
+
+// samples a synthetic /proc tree and reports what reading one process costs, so that parsers can be compared
+
+static atomic<uint64_t> allocations = 0; // heap allocations of the whole program
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (auto data = malloc(size == 0 ? 1 : size)) {
+        return data;
+    }
+    throw bad_alloc();
+}
+
+// all of them come from malloc, whatever the compiler assumes about operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void *data) noexcept { free(data); }
+
+void operator delete(void *data, size_t) noexcept { free(data); }
+
+#pragma GCC diagnostic pop
+
+namespace fs = filesystem;
+
+class Bench {
+private:
+    string root;
+    vector<string> pids;
+    size_t rounds;
+    size_t maxThreads;
+    mt19937_64 random{42}; // fixed, so that runs are comparable
+
+    void writeFile(const fs::path &path, const string &data) {
+        ofstream stream(path, ios::binary);
+        stream << data;
+    }
+
+    string makeStat(size_t pid) {
+        // every tenth process names itself like a tmux server, with spaces and parentheses in comm
+        auto name = pid % 10 == 0 ? "tmux: server (" + to_string(pid) + ")" : "worker-" + to_string(pid);
+        auto priority = pid % 7 == 0 ? -51 : 20; // real-time ones are negative
+        stringstream ss;
+        ss << pid << " (" << name << ") S " << pid / 2 << " " << pid << " " << pid << " 0 -1 4194560 "
+           << random() % 100000 << " 0 " << random() % 100 << " 0 " << random() % 1000000 << " "
+           << random() % 100000 << " 0 0 " << priority << " " << (pid % 7 == 0 ? 0 : pid % 40 - 20)
+           << " 1 0 " << random() % 10000000 << " " << random() % (1ull << 32) << " " << random() % 100000;
+        for (auto i = 25; i <= 52; i++) { // the rest only has to be there
+            ss << " " << random() % 1000;
+        }
+        ss << "\n";
+        return ss.str();
+    }
+
+    string makeStatus(size_t pid) {
+        stringstream ss;
+        ss << "Name:\tworker-" << pid << "\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t" << pid << "\nNgid:\t0\n"
+           << "Pid:\t" << pid << "\nPPid:\t" << pid / 2 << "\nTracerPid:\t0\nUid:\t0\t0\t0\t0\nGid:\t0\t0\t0\t0\n"
+           << "FDSize:\t64\nGroups:\t\nNStgid:\t" << pid << "\nNSpid:\t" << pid << "\nNSpgid:\t" << pid << "\n"
+           << "NSsid:\t" << pid << "\nVmPeak:\t  " << random() % 1000000 << " kB\nVmSize:\t  "
+           << random() % 1000000 << " kB\nVmLck:\t       0 kB\nVmPin:\t       0 kB\nVmHWM:\t    "
+           << random() % 100000 << " kB\nVmRSS:\t    " << random() % 100000 << " kB\nRssAnon:\t    "
+           << random() % 10000 << " kB\nRssFile:\t    " << random() % 10000 << " kB\nRssShmem:\t       "
+           << random() % 1000 << " kB\nVmData:\t    1234 kB\nVmStk:\t     132 kB\nVmExe:\t     888 kB\n"
+           << "VmLib:\t    2048 kB\nVmPTE:\t      64 kB\nVmSwap:\t       0 kB\nHugetlbPages:\t       0 kB\n"
+           << "CoreDumping:\t0\nTHP_enabled:\t1\nThreads:\t1\nSigQ:\t0/63412\nSigPnd:\t0000000000000000\n"
+           << "ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\nSigIgn:\t0000000000001000\n"
+           << "SigCgt:\t0000000180004002\nCapInh:\t0000000000000000\nCapPrm:\t000001ffffffffff\n"
+           << "CapEff:\t000001ffffffffff\nCapBnd:\t000001ffffffffff\nCapAmb:\t0000000000000000\nNoNewPrivs:\t0\n"
+           << "Seccomp:\t0\nSeccomp_filters:\t0\nSpeculation_Store_Bypass:\tthread vulnerable\n"
+           << "Cpus_allowed:\tff\nCpus_allowed_list:\t0-7\nMems_allowed:\t1\nMems_allowed_list:\t0\n"
+           << "voluntary_ctxt_switches:\t" << random() % 10000 << "\nnonvoluntary_ctxt_switches:\t"
+           << random() % 100 << "\n";
+        return ss.str();
+    }
+
+    string makeCommand(size_t pid) { // from nothing, like kernel threads, to a long java command line
+        auto length = pid % 5 == 0 ? 0 : random() % (pid % 50 == 1 ? 4000 : 200);
+        string command = "/usr/bin/worker";
+        while (command.length() < length) {
+            command += '\0';
+            command += "--option-" + to_string(random() % 1000);
+        }
+        return command + '\0';
+    }
+
+    template<typename Sample>
+    void run(const string &name, const Sample &sample) {
+        auto allocated = allocations.load();
+        auto start = chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; round++) {
+            sample();
+        }
+        auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        auto samples = (double) rounds * pids.size();
+        cout << left << setw(16) << name << right << setw(10) << pids.size() << setw(8) << rounds
+             << setw(14) << fixed << setprecision(0) << seconds * 1e9 / samples
+             << setw(14) << setprecision(1) << (allocations - allocated) / samples << endl;
+    }
+
+public:
+    Bench(string root, size_t processes, size_t rounds, size_t maxThreads)
+        : root(std::move(root)), rounds(rounds), maxThreads(maxThreads) {
+        fs::create_directories(this->root + "/sys/kernel");
+        writeFile(this->root + "/stat", "cpu  4705 356 584 3699176 23060 0 277 0 0 0\n");
+        writeFile(this->root + "/meminfo", "MemTotal:       16303428 kB\nMemFree:         8128508 kB\n"
+                                           "SwapTotal:       2097148 kB\nSwapFree:        2097148 kB\n");
+        writeFile(this->root + "/cpuinfo", "vendor_id\t: GenuineIntel\nsiblings\t: 8\ncpu cores\t: 4\n\n");
+        writeFile(this->root + "/uptime", "12345.67 45678.90\n");
+        writeFile(this->root + "/version", "Linux version 5.4.0 (synthetic)\n");
+        writeFile(this->root + "/sys/kernel/hostname", "bench\n");
+        writeFile(this->root + "/modules", "");
+        for (size_t pid = 1; pid <= processes; pid++) {
+            auto directory = fs::path(this->root) / to_string(pid);
+            fs::create_directory(directory);
+            writeFile(directory / "stat", makeStat(pid));
+            writeFile(directory / "status", makeStatus(pid));
+            writeFile(directory / "cmdline", makeCommand(pid));
+            pids.push_back(to_string(pid));
+        }
+    }
+
+    void runAll() {
+        cout << left << setw(16) << "workload" << right << setw(10) << "processes" << setw(8) << "rounds"
+             << setw(14) << "ns/process" << setw(14) << "allocs/proc" << endl;
+
+        // what getUsage did before ProcParser: ifstreams, a string for every field, stoull and getline
+        run("ifstream+split", [this] {
+            using is_iter = istreambuf_iterator<char>;
+            for (const auto &pid: pids) {
+                auto path = fs::path(root) / pid;
+                ifstream status(path / "status");
+                ifstream stat(path / "stat");
+                ifstream command(path / "cmdline");
+                auto fields = Utils::split(string(is_iter(stat), is_iter()), " ");
+                if (fields.size() != 52) {
+                    continue;
+                }
+                volatile auto sum = stoull(fields[0]) + stoull(fields[3]) + stod(fields[13]) + stod(fields[14])
+                                    + stoull(fields[17]) + stoull(fields[18]);
+                string commandLine{is_iter(command), is_iter()};
+                string line, name;
+                Utils::ull memory = 0;
+                while (getline(status, line)) {
+                    if (line.substr(0, 4) == "Name") {
+                        name = line.substr(6);
+                    } else if (line.substr(0, 6) == "VmSize" || line.substr(0, 5) == "VmRSS"
+                               || line.substr(0, 3) == "Uid" || line.substr(0, 7) == "RssFile"
+                               || line.substr(0, 8) == "RssShmem") {
+                        memory += Utils::parseLine(line);
+                    }
+                }
+                (void) sum;
+            }
+        });
+
+        // the files of a process read into one buffer and parsed in place, strings only for what is kept
+        ProcParser parser;
+        string path;
+        run("ProcParser", [&] {
+            for (const auto &pid: pids) {
+                path.assign(root).append("/").append(pid).append("/stat");
+                ProcParser::Stat stat{};
+                if (!ProcParser::parseStat(parser.read(path.c_str()), stat)) {
+                    continue;
+                }
+                path.assign(root).append("/").append(pid).append("/cmdline");
+                string command(parser.read(path.c_str()));
+                path.assign(root).append("/").append(pid).append("/status");
+                ProcParser::Status status{};
+                ProcParser::parseStatus(parser.read(path.c_str()), status);
+                string name(status.name);
+            }
+        });
+
+        // a whole tick, which also reads the system totals, lists /proc and fills ProcessInfo of every process;
+        // first opening every file again like without files kept open, then with as many threads as there are
+        // cores and fewer to see how it scales
+        {
+            Monitor monitor(root, 1, 0);
+            monitor.sample();
+            run("sample-reopen", [&monitor] { monitor.sample(); });
+        }
+        for (size_t threads = 1;; threads = min(threads * 2, maxThreads)) {
+            Monitor monitor(root, threads);
+            monitor.sample(); // users and processes are known from now on, like in every tick but the first
+            run("sample-" + to_string(threads), [&monitor] { monitor.sample(); });
+            if (threads == maxThreads) {
+                break;
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    size_t processes = 2000, rounds = 10, threads = max(thread::hardware_concurrency(), 1u);
+    auto keep = false; // a root given is left for inspection
+    string root = (fs::temp_directory_path() / "itop_bench_proc").string();
+    for (auto i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--processes" && i + 1 < argc) {
+            processes = stoul(argv[++i]);
+        } else if (arg == "--rounds" && i + 1 < argc) {
+            rounds = stoul(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = max(stoul(argv[++i]), 1ul);
+        } else if (arg == "--root" && i + 1 < argc) {
+            root = argv[++i];
+            keep = true;
+        } else {
+            cerr << "Usage: " << argv[0] << " [--processes <n>] [--rounds <n>] [--threads <n>]"
+                 << " [--root <directory>]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (keep && fs::exists(root)) { // never clean up a directory the tree was not made in
+        cerr << root << " already exists" << endl;
+        return EXIT_FAILURE;
+    }
+    fs::remove_all(root); // a fresh tree every run
+    {
+        Bench bench(root, processes, rounds, threads);
+        bench.runAll();
+    }
+    if (!keep) {
+        fs::remove_all(root);
+    }
+    return EXIT_SUCCESS;
+}
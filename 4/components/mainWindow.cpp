@@ -1,6 +1,8 @@
 #include "mainWindow.h"
 
-MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
+MainWindow::MainWindow(size_t threads, bool followEvents, QWidget *parent)
+    : QMainWindow(parent), monitor("/proc", threads, Monitor::getOpenFileLimit(), followEvents),
+      sampler(monitor, chrono::seconds(1)) {
     auto tabWidget = new QTabWidget();
     performanceTab = new PerformanceTab();
     processTab = new ProcessTab();
@@ -16,13 +18,16 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent) {
 
     setCentralWidget(tabWidget);
     resize(1280, 720);
-    startTimer(1000);
+    startTimer(100); // only looks for a new snapshot, so a tick is shown soon after it is sampled
 }
 
 void MainWindow::timerEvent(QTimerEvent *) {
-    auto usage = monitor.getUsage();
-    performanceTab->updateData(monitor.getCPUTime(), usage.cpuUsage, monitor.getMemoryInfo());
-    processTab->updateData(usage.processes);
+    auto snapshot = sampler.take();
+    if (snapshot == nullptr) { // nothing sampled since the last one, or sampling is slow
+        return;
+    }
+    performanceTab->updateData(*snapshot);
+    processTab->updateData(*snapshot);
 }
 
 MainWindow::~MainWindow() {
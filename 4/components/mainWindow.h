@@ -4,6 +4,7 @@
 #include <QMainWindow>
 
 #include "../core/monitor.h"
+#include "../core/sampler.h"
 #include "performanceTab.h"
 #include "systemTab.h"
 #include "processTab.h"
@@ -14,7 +15,8 @@ class MainWindow : public QMainWindow {
 Q_OBJECT
 
 public:
-    explicit MainWindow(QWidget *parent = nullptr);
+    // threads read /proc every tick, followEvents learns of processes from the kernel instead of listing /proc
+    MainWindow(size_t threads, bool followEvents, QWidget *parent = nullptr);
 
     ~MainWindow() override;
 
@@ -25,6 +27,7 @@ private:
     PerformanceTab *performanceTab;
     ProcessTab *processTab;
     Monitor monitor;
+    Sampler sampler; // after monitor, so it stops before monitor goes away
 };
 
 #endif // _MAIN_WINDOW_H
@@ -76,7 +76,9 @@ PerformanceTab::~PerformanceTab() {
     delete cpuUsageSeries;
 }
 
-void PerformanceTab::updateData(Monitor::TimeInfo cpuTime, double cpuUsage, Monitor::MemoryInfo memoryInfo) {
+void PerformanceTab::updateData(const Monitor::Snapshot &snapshot) {
+    auto &cpuTime = snapshot.cpuTime;
+    auto cpuUsage = snapshot.cpuUsage;
     bootTimeLabel->setText(Utils::formatTimePoint(cpuTime.bootTime).c_str());
     idleTimeLabel->setText(Utils::formatTime(cpuTime.idleTime).c_str());
     upTimeLabel->setText(Utils::formatTime(cpuTime.upTime).c_str());
@@ -93,7 +95,7 @@ void PerformanceTab::updateData(Monitor::TimeInfo cpuTime, double cpuUsage, Moni
     cpuUsageWidget->setValue(cpuUsage * 100);
     cpuUsageWidget->setPalette(getColorPalette(cpuUsage));
 
-    auto[totalVirtual, usedVirtual, totalPhysical, usedPhysical] = memoryInfo;
+    auto[totalVirtual, usedVirtual, totalPhysical, usedPhysical] = snapshot.memoryInfo;
     auto virtualMemoryUsage = (double) usedVirtual / totalVirtual;
     auto physicalMemoryUsage = (double) usedPhysical / totalPhysical;
     virtualMemoryUsageWidget->setFormat(
@@ -18,7 +18,7 @@ public:
 
     ~PerformanceTab() override;
 
-    void updateData(Monitor::TimeInfo cpuTime, double cpuUsage, Monitor::MemoryInfo memoryInfo);
+    void updateData(const Monitor::Snapshot &snapshot);
 
 private:
     QPalette getColorPalette(double percentage);
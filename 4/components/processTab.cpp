@@ -34,10 +34,10 @@ ProcessTab::~ProcessTab() {
     delete processTable;
 }
 
-void ProcessTab::updateData(const map<Monitor::ull, Monitor::ProcessInfo> &processes) {
+void ProcessTab::updateData(const Monitor::Snapshot &snapshot) {
     int rowNum = 0;
-    for (auto[_, process]: processes) {
-        auto[
+    for (const auto &process: snapshot.processes) {
+        const auto &[
         pid,
         uid,
         parentPid,
@@ -13,7 +13,7 @@ public:
 
     ~ProcessTab() override;
 
-    void updateData(const map<Monitor::ull, Monitor::ProcessInfo> &processes);
+    void updateData(const Monitor::Snapshot &snapshot);
 
 private:
     QTableWidget *processTable;
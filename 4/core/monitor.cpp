@@ -1,18 +1,20 @@
 #include <fstream>
 #include <regex>
-#include <filesystem>
 #include <unistd.h>
+#include <dirent.h>
 #include <pwd.h>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/resource.h>
 #include <iostream>
 
 #include "monitor.h"
-#include "../utils/utils.h"
 
-void Monitor::readJiffies() {
-    ifstream cpuUsage("/proc/stat");
+Monitor::CPUJiffies Monitor::readJiffies() {
+    ifstream cpuUsage(root + "/stat");
     string tmp, user, nice, system, idle, ioWait, irq, softIrq;
     cpuUsage >> tmp >> user >> nice >> system >> idle >> ioWait >> irq >> softIrq;
-    usage.currentJiffies = {
+    return {
         stoull(user),
         stoull(nice),
         stoull(system),
@@ -28,7 +30,7 @@ string Monitor::getVersion() {
 }
 
 void Monitor::readVersion() {
-    ifstream ifs("/proc/version");
+    ifstream ifs(root + "/version");
     getline(ifs, version);
 }
 
@@ -37,7 +39,7 @@ Monitor::CPUInfo Monitor::getCPUInfo() {
 }
 
 void Monitor::readCPUInfo() {
-    ifstream ifs("/proc/cpuinfo");
+    ifstream ifs(root + "/cpuinfo");
     string line;
     // Use regexps here because cpu info is only fetched once
     regex re_vendor(R"(vendor_id\s*:\s*(.*))");
@@ -66,22 +68,21 @@ void Monitor::readCPUInfo() {
     }
 }
 
-Monitor::MemoryInfo Monitor::getMemoryInfo() {
-    ifstream ifs("/proc/meminfo");
-    string line;
-    ull totalRAM;
-    ull freeRAM;
-    ull totalSwap;
-    ull freeSwap;
-    while (getline(ifs, line)) {
-        if (line.substr(0, 8) == "MemTotal") {
-            totalRAM = Utils::parseLine(line) * 1000;
-        } else if (line.substr(0, 7) == "MemFree") {
-            freeRAM = Utils::parseLine(line) * 1000;
-        } else if (line.substr(0, 9) == "SwapTotal") {
-            totalSwap = Utils::parseLine(line) * 1000;
-        } else if (line.substr(0, 8) == "SwapFree") {
-            freeSwap = Utils::parseLine(line) * 1000;
+Monitor::MemoryInfo Monitor::readMemoryInfo() {
+    auto data = parser.read((root + "/meminfo").c_str());
+    ull totalRAM = 0;
+    ull freeRAM = 0;
+    ull totalSwap = 0;
+    ull freeSwap = 0;
+    for (auto line = ProcParser::nextToken(data, '\n'); !line.empty(); line = ProcParser::nextToken(data, '\n')) {
+        if (line.starts_with("MemTotal:")) {
+            totalRAM = ProcParser::parseNumber(line) * 1000;
+        } else if (line.starts_with("MemFree:")) {
+            freeRAM = ProcParser::parseNumber(line) * 1000;
+        } else if (line.starts_with("SwapTotal:")) {
+            totalSwap = ProcParser::parseNumber(line) * 1000;
+        } else if (line.starts_with("SwapFree:")) {
+            freeSwap = ProcParser::parseNumber(line) * 1000;
         }
     }
     ull totalPhysical = totalRAM;
@@ -96,92 +97,187 @@ Monitor::MemoryInfo Monitor::getMemoryInfo() {
     };
 }
 
-Monitor::Usage Monitor::getUsage() {
-    using is_iter = istreambuf_iterator<char>;
-    namespace fs = filesystem;
-    auto prevBusy = usage.currentJiffies.busy();
-    auto prevTotal = usage.currentJiffies.total();
-    readJiffies();
-    auto diffBusy = (double) (usage.currentJiffies.busy() - prevBusy);
-    auto diffTotal = (double) (usage.currentJiffies.total() - prevTotal);
-    auto cpuCount = cpuInfo.processors;
-    usage.cpuUsage = diffBusy / diffTotal;
-    vector<ull> killed;
-    for (auto[pid, _]: usage.processes) {
-        if (!fs::exists(fs::path("/proc") / to_string(pid))) {
-            killed.push_back(pid);
+string_view Monitor::readProcessFile(Worker &worker, ull pid, const char *file) {
+    char number[20];
+    auto end = to_chars(number, number + sizeof(number), pid).ptr;
+    worker.filePath.assign(root).append("/").append(number, end).append("/").append(file);
+    return worker.parser.read(worker.filePath.c_str());
+}
+
+string_view Monitor::readProcessFile(Worker &worker, ull pid, const char *file, int &fd, bool keep) {
+    if (fd >= 0) {
+        return worker.parser.read(fd);
+    }
+    if (!keep) {
+        return readProcessFile(worker, pid, file);
+    }
+    char number[20];
+    auto end = to_chars(number, number + sizeof(number), pid).ptr;
+    worker.filePath.assign(root).append("/").append(number, end).append("/").append(file);
+    fd = open(worker.filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd >= 0 ? worker.parser.read(fd) : string_view();
+}
+
+void Monitor::closeFiles(ProcessFiles &processFiles) {
+    for (auto fd: {&processFiles.stat, &processFiles.status}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
         }
     }
-    for (auto pid: killed) {
-        usage.processes.erase(pid);
-    }
-    for (const auto &p: fs::directory_iterator("/proc")) {
-        const auto &path = p.path();
-        auto filename = path.filename().string();
-        auto isProcess = true;
-        for (auto ch: filename) {
-            if (ch < '0' || ch > '9') {
-                isProcess = false;
-                break;
-            }
+}
+
+void Monitor::readProcess(Worker &worker, ull pid, ProcessFiles &processFiles, const MemoryInfo &memoryInfo) {
+    // every file goes through the same buffer, so each one is parsed before the next is read
+    ProcParser::Stat stat{};
+    if (!ProcParser::parseStat(readProcessFile(worker, pid, "stat", processFiles.stat, processFiles.open), stat)) {
+        if (processFiles.stat < 0) {
+            return; // gone, or not a process
+        }
+        // the files kept open are of a process that is gone, the pid may have been taken by another one since
+        closeFiles(processFiles);
+        if (!ProcParser::parseStat(readProcessFile(worker, pid, "stat", processFiles.stat, processFiles.open),
+                                   stat)) {
+            return;
         }
-        if (p.is_directory() && isProcess) {
-            ifstream status(path / "status");
-            ifstream stat(path / "stat");
-            ifstream command(path / "cmdline");
-            string line;
-            ProcessInfo process{};
-            auto fields = Utils::split(string(is_iter(stat), is_iter()), " ");
-            auto fieldsCount = 52;
-            if (fields.size() != fieldsCount) {
+    }
+    // files kept open cannot be of another process by now, as those of a process that is gone are closed above
+    if (!processFiles.known || processFiles.startTime != stat.startTime) {
+        processFiles.known = true;
+        processFiles.startTime = stat.startTime;
+        processFiles.command = readProcessFile(worker, pid, "cmdline");
+        replace(processFiles.command.begin(), processFiles.command.end(), '\0', ' ');
+    }
+    ProcessInfo process{};
+    process.pid = stat.pid;
+    process.state = string(1, stat.state);
+    process.parentPid = stat.parentPid;
+    process.time = duration<double>((double) (stat.userTime + stat.systemTime) / clockTicks);
+    process.priority = stat.priority; // negative ones wrap around as they did with stoull
+    process.nice = stat.nice;
+    process.command = processFiles.command;
+    ProcParser::Status status{};
+    ProcParser::parseStatus(readProcessFile(worker, pid, "status", processFiles.status, processFiles.open), status);
+    process.name = status.name;
+    process.uid = status.uid;
+    process.virtualMemory = status.virtualMemory;
+    process.physicalMemory = status.physicalMemory;
+    process.sharedMemory = status.sharedMemory;
+    process.memoryUsage = (double) process.physicalMemory / memoryInfo.totalPhysical;
+    worker.processes.push_back(move(process));
+}
+
+bool Monitor::listProcesses() {
+    auto complete = true;
+    if (events != nullptr) {
+        received.clear();
+        complete = events->read(received);
+        for (auto[type, pid]: received) { // in order, a pid may have been taken by another process in between
+            if (type == ProcEvents::Type::EXIT) {
+                tracked.erase(pid);
                 continue;
             }
-            process.pid = stoull(fields[0]);
-            process.state = fields[2];
-            process.parentPid = stoull(fields[3]);
-            auto hz = sysconf(_SC_CLK_TCK);
-            auto uTime = stod(fields[13]);
-            auto sTime = stod(fields[14]);
-//            auto cuTime = stod(fields[15]);
-//            auto csTime = stod(fields[16]);
-            auto currProcessTime = (uTime + sTime) / hz;
-            auto prevProcessTime = usage.processes.count(process.pid) ? usage.processes[process.pid].time.count() : 0;
-            process.time = duration<double>(currProcessTime);
-            process.priority = stoull(fields[17]);
-            process.nice = stoull(fields[18]);
-            process.cpuUsage = (currProcessTime - prevProcessTime) * hz * cpuCount / diffTotal;
-            process.command = string(is_iter(command), is_iter());
-            replace(process.command.begin(), process.command.end(), '\0', ' ');
-            while (getline(status, line)) {
-                if (line.substr(0, 4) == "Name") {
-                    process.name = line.substr(6); // magic number 6 is the start of name value
-                } else if (line.substr(0, 6) == "VmSize") {
-                    process.virtualMemory = Utils::parseLine(line) * 1000;
-                } else if (line.substr(0, 5) == "VmRSS") {
-                    process.physicalMemory = Utils::parseLine(line) * 1000;
-                } else if (line.substr(0, 3) == "Uid") {
-                    process.uid = Utils::parseLine(line);
-                } else if (line.substr(0, 7) == "RssFile") {
-                    process.sharedMemory = Utils::parseLine(line) * 1000;
-                } else if (line.substr(0, 8) == "RssShmem") {
-                    process.sharedMemory += Utils::parseLine(line) * 1000;
-                }
-            }
-            process.memoryUsage = (double) process.physicalMemory / getMemoryInfo().totalPhysical;
-            if (!users.count(process.uid)) {
-                auto pw = getpwuid(process.uid);
-                users[process.uid] = string(pw->pw_name);
+            tracked.insert(pid);
+            if (auto it = files.find(pid); type == ProcEvents::Type::EXEC && it != files.end()) {
+                it->second.known = false; // the same process with another command line
             }
-            process.user = users[process.uid];
-            usage.processes[process.pid] = process;
         }
+        if (complete && tick < nextScan) {
+            pids.assign(tracked.begin(), tracked.end());
+            return true;
+        }
+    }
+    auto directory = opendir(root.c_str());
+    if (directory == nullptr) {
+        return false;
+    }
+    pids.clear();
+    while (auto entry = readdir(directory)) {
+        string_view filename = entry->d_name;
+        ull pid;
+        auto[end, error] = from_chars(filename.data(), filename.data() + filename.size(), pid);
+        if (error == errc() && end == filename.data() + filename.size()
+            && (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN)) {
+            pids.push_back(pid);
+        }
+    }
+    closedir(directory);
+    if (events != nullptr) {
+        tracked.clear();
+        tracked.insert(pids.begin(), pids.end());
+        nextScan = tick + RESCAN_TICKS;
+    }
+    return true;
+}
+
+shared_ptr<const Monitor::Snapshot> Monitor::sample() {
+    auto snapshot = make_shared<Snapshot>();
+    // system totals are read once, every process below is put in relation to them
+    snapshot->jiffies = readJiffies();
+    snapshot->memoryInfo = readMemoryInfo();
+    snapshot->cpuTime = readCPUTime();
+    auto diffTotal = (double) (snapshot->jiffies.total() - (last ? last->jiffies.total() : 0));
+    auto diffBusy = (double) (snapshot->jiffies.busy() - (last ? last->jiffies.busy() : 0));
+    snapshot->cpuUsage = diffBusy / diffTotal;
+    auto cpuCount = cpuInfo.processors;
+    tick++;
+    if (!listProcesses()) {
+        return last = snapshot;
+    }
+    listedFiles.clear();
+    for (auto pid: pids) {
+        auto &processFiles = files[pid];
+        processFiles.tick = tick;
+        // every process is read in every tick, so the first ones up to the limit keep their files until they are
+        // gone, the others are read by path
+        if (!processFiles.open && openProcesses < maxOpenProcesses) {
+            processFiles.open = true;
+            openProcesses++;
+        }
+        listedFiles.push_back(&processFiles);
+    }
+    // each worker only appends to its own list, they are put together once all are done
+    pool.run(pids.size(), [this, &snapshot](size_t worker, size_t index) {
+        readProcess(workers[worker], pids[index], *listedFiles[index], snapshot->memoryInfo);
+    });
+    for (auto it = files.begin(); it != files.end();) {
+        if (it->second.tick == tick) {
+            it++;
+            continue;
+        }
+        closeFiles(it->second); // the process is gone
+        openProcesses -= it->second.open;
+        it = files.erase(it);
     }
-    return usage;
+    auto &processes = snapshot->processes;
+    processes.reserve(pids.size());
+    for (auto &worker: workers) {
+        move(worker.processes.begin(), worker.processes.end(), back_inserter(processes));
+        worker.processes.clear();
+    }
+    sort(processes.begin(), processes.end(), [](auto &a, auto &b) { return a.pid < b.pid; });
+    // both are sorted, so the previous time of every process is found in one walk; processes that are gone are
+    // simply not in the new snapshot
+    auto previous = last ? last->processes.begin() : vector<ProcessInfo>::const_iterator();
+    auto end = last ? last->processes.end() : previous;
+    for (auto &process: processes) {
+        while (previous != end && previous->pid < process.pid) {
+            previous++;
+        }
+        auto prevProcessTime = previous != end && previous->pid == process.pid ? previous->time.count() : 0;
+        process.cpuUsage = (process.time.count() - prevProcessTime) * clockTicks * cpuCount / diffTotal;
+        if (!users.count(process.uid)) { // getpwuid is not thread safe, so users are looked up here
+            auto pw = getpwuid(process.uid);
+            users[process.uid] = pw != nullptr ? string(pw->pw_name) : to_string(process.uid);
+        }
+        process.user = users[process.uid];
+    }
+    return last = snapshot;
 }
 
-Monitor::TimeInfo Monitor::getCPUTime() {
+Monitor::TimeInfo Monitor::readCPUTime() {
     using namespace chrono;
-    ifstream ifs("/proc/uptime");
+    ifstream ifs(root + "/uptime");
     string first, second;
     ifs >> first >> second;
     auto upTime = duration<double>(stod(first));
@@ -196,7 +292,7 @@ Monitor::TimeInfo Monitor::getCPUTime() {
 }
 
 void Monitor::readHostname() {
-    ifstream ifs("/proc/sys/kernel/hostname");
+    ifstream ifs(root + "/sys/kernel/hostname");
     getline(ifs, hostname);
 }
 
@@ -205,7 +301,7 @@ string Monitor::getHostname() {
 }
 
 void Monitor::readModules() {
-    ifstream ifs("/proc/modules");
+    ifstream ifs(root + "/modules");
 //    stringstream ifs(R"(veth 20480 0 - Live 0xffffffffc0695000
 //xt_conntrack 16384 1 - Live 0xffffffffc0690000
 //ipt_MASQUERADE 16384 1 - Live 0xffffffffc068b000
@@ -237,11 +333,32 @@ vector<Monitor::ModuleInfo> Monitor::getModules() {
     return modules;
 }
 
-Monitor::Monitor() {
+size_t Monitor::getOpenFileLimit() {
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY) {
+        return 512;
+    }
+    return limit.rlim_cur / 2;
+}
+
+Monitor::Monitor(string root, size_t threads, size_t maxOpenFiles, bool followEvents)
+    : root(std::move(root)), maxOpenProcesses(maxOpenFiles / ProcessFiles::COUNT), workers(max(threads, (size_t) 1)),
+      pool(workers.size()), clockTicks(sysconf(_SC_CLK_TCK)) {
+    if (followEvents) {
+        events = make_unique<ProcEvents>();
+        if (!events->isListening()) {
+            cerr << "Unable to follow process events, e.g. without CAP_NET_ADMIN, listing /proc every tick" << endl;
+            events = nullptr;
+        }
+    }
     readCPUInfo();
     readVersion();
     readHostname();
     readModules();
 }
 
-Monitor::~Monitor() = default;
+Monitor::~Monitor() {
+    for (auto &[_, processFiles]: files) {
+        closeFiles(processFiles);
+    }
+}
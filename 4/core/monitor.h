@@ -3,8 +3,14 @@
 
 #include <string>
 #include <vector>
-#include <map>
+#include <memory>
 #include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+
+#include "procParser.h"
+#include "threadPool.h"
+#include "procEvents.h"
 
 using namespace std;
 using namespace chrono;
@@ -30,9 +36,9 @@ public:
         ull irq;
         ull softirq;
 
-        inline ull busy() { return user + nice + system + irq + softirq; }
+        inline ull busy() const { return user + nice + system + irq + softirq; }
 
-        inline ull total() { return busy() + idle + iowait; }
+        inline ull total() const { return busy() + idle + iowait; }
     };
 
     struct MemoryInfo {
@@ -60,18 +66,21 @@ public:
         string state;
     };
 
-    struct Usage {
-        map<ull, ProcessInfo> processes;
-        CPUJiffies currentJiffies;
-        double cpuUsage;
-    };
-
     struct TimeInfo {
         duration<double> upTime;
         duration<double> idleTime;
         time_point<system_clock> bootTime;
     };
 
+    // everything of one tick, read in one pass and never changed afterwards, so every tab can hold on to it
+    struct Snapshot {
+        vector<ProcessInfo> processes; // sorted by pid
+        CPUJiffies jiffies;
+        double cpuUsage;
+        MemoryInfo memoryInfo;
+        TimeInfo cpuTime;
+    };
+
     struct ModuleInfo {
         string name;
         ull memorySize;
@@ -80,14 +89,51 @@ public:
         string state;
     };
 private:
+    struct Worker { // what a thread of the pool reads processes with, nothing of it is shared
+        ProcParser parser;
+        string filePath; // reused for every file read by parser
+        vector<ProcessInfo> processes; // read in this tick, merged into the snapshot afterwards
+    };
+
+    struct ProcessFiles { // of a process, kept between ticks so that they are not opened and parsed every time
+        const static size_t COUNT = 2; // stat and status, cmdline is read once
+
+        int stat = -1;
+        int status = -1;
+        bool open = false; // may keep stat and status open, there is a limit to how many processes do
+        bool known = false; // startTime and command are of this process
+        ull startTime = 0;
+        string command; // read again only if the pid is taken by another process
+        ull tick = 0; // the last one the pid was listed in, gone after that
+    };
+
+    string root; // where procfs is mounted, a synthetic tree for benchmarks
+    ProcParser parser; // of system files, read on the calling thread
+    vector<ull> pids; // listed in this tick
+    unique_ptr<ProcEvents> events; // null if /proc is listed every tick
+    vector<ProcEvents::Event> received;
+    unordered_set<ull> tracked; // pids known from listing /proc once and the events since
+    ull nextScan = 0; // tick /proc is listed in again even with events, in case something was missed
+    vector<ProcessFiles *> listedFiles; // of pids, only the worker reading a pid touches them
+    unordered_map<ull, ProcessFiles> files; // pid -> files
+    size_t maxOpenProcesses; // with files kept open
+    size_t openProcesses = 0;
+    ull tick = 0;
+    vector<Worker> workers;
+    ThreadPool pool;
     unordered_map<ull, string> users; // uid -> username
     vector<ModuleInfo> modules;
-    Usage usage;
+    shared_ptr<const Snapshot> last; // the previous tick, deltas are taken against it
+    long clockTicks; // per second
     CPUInfo cpuInfo;
     string version;
     string hostname;
 
-    void readJiffies();
+    CPUJiffies readJiffies();
+
+    MemoryInfo readMemoryInfo();
+
+    TimeInfo readCPUTime();
 
     void readVersion();
 
@@ -97,8 +143,26 @@ private:
 
     void readModules();
 
+    string_view readProcessFile(Worker &worker, ull pid, const char *file); // e.g. (42, "stat")
+
+    // through fd if it is open, and leaves it open if keep
+    string_view readProcessFile(Worker &worker, ull pid, const char *file, int &fd, bool keep);
+
+    static void closeFiles(ProcessFiles &processFiles);
+
+    bool listProcesses(); // into pids, false if root cannot be listed
+
+    void readProcess(Worker &worker, ull pid, ProcessFiles &processFiles, const MemoryInfo &memoryInfo);
+
 public:
-    Monitor();
+    const static ull RESCAN_TICKS = 60;
+
+    static size_t getOpenFileLimit(); // half of RLIMIT_NOFILE, what the files of processes may take
+
+    // processes are read by that many threads, the calling one included, and keep at most maxOpenFiles open;
+    // followEvents keeps track of processes with the proc connector of netlink if permitted, for the real /proc only
+    explicit Monitor(string root = "/proc", size_t threads = thread::hardware_concurrency(),
+                     size_t maxOpenFiles = getOpenFileLimit(), bool followEvents = false);
 
     ~Monitor();
 
@@ -108,11 +172,7 @@ public:
 
     CPUInfo getCPUInfo();
 
-    Usage getUsage();
-
-    MemoryInfo getMemoryInfo();
-
-    TimeInfo getCPUTime();
+    shared_ptr<const Snapshot> sample(); // reads the tick, /proc is not touched afterwards
 
     vector<ModuleInfo> getModules();
 };
@@ -0,0 +1,106 @@
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "procEvents.h"
+
+static bool sendOperation(int socket, proc_cn_mcast_op operation) {
+    // nlmsghdr, cn_msg and the operation right after each other
+    alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))]{};
+    auto header = (nlmsghdr *) request;
+    header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+    header->nlmsg_type = NLMSG_DONE;
+    header->nlmsg_pid = getpid();
+    auto message = (cn_msg *) NLMSG_DATA(header);
+    message->id.idx = CN_IDX_PROC;
+    message->id.val = CN_VAL_PROC;
+    message->len = sizeof(proc_cn_mcast_op);
+    memcpy(message->data, &operation, sizeof(operation));
+    return send(socket, request, header->nlmsg_len, 0) >= 0;
+}
+
+ProcEvents::ProcEvents() : buffer(64 * 1024) {
+    socket = ::socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (socket < 0) {
+        return;
+    }
+    sockaddr_nl address{};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = CN_IDX_PROC;
+    // joining the group is what needs the privileges
+    if (bind(socket, (sockaddr *) &address, sizeof(address)) != 0) {
+        close(socket);
+        socket = -1;
+        return;
+    }
+    if (!sendOperation(socket, PROC_CN_MCAST_LISTEN)) {
+        close(socket);
+        socket = -1;
+    }
+}
+
+ProcEvents::~ProcEvents() {
+    if (socket >= 0) {
+        sendOperation(socket, PROC_CN_MCAST_IGNORE); // the kernel stops reporting once the last listener leaves
+        close(socket);
+    }
+}
+
+bool ProcEvents::isListening() const {
+    return socket >= 0;
+}
+
+bool ProcEvents::read(vector<Event> &events) {
+    auto complete = true;
+    while (true) {
+        sockaddr_nl sender{};
+        socklen_t senderLength = sizeof(sender);
+        auto n = recvfrom(socket, buffer.data(), buffer.size(), 0, (sockaddr *) &sender, &senderLength);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == ENOBUFS) { // the socket overflowed, what is queued after that is still read
+                complete = false;
+                continue;
+            }
+            return complete; // EAGAIN, nothing left
+        }
+        if (sender.nl_pid != 0) { // only the kernel is listened to
+            continue;
+        }
+        for (auto header = (nlmsghdr *) buffer.data(); NLMSG_OK(header, n); header = NLMSG_NEXT(header, n)) {
+            if (header->nlmsg_type != NLMSG_DONE) {
+                continue;
+            }
+            auto message = (cn_msg *) NLMSG_DATA(header);
+            if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC
+                || message->len < sizeof(proc_event)) {
+                continue;
+            }
+            auto event = (proc_event *) message->data;
+            // threads share the tgid of their process and are left out
+            switch (event->what) {
+                case proc_event::PROC_EVENT_FORK:
+                    if (event->event_data.fork.child_pid == event->event_data.fork.child_tgid) {
+                        events.push_back({Type::FORK, (ull) event->event_data.fork.child_tgid});
+                    }
+                    break;
+                case proc_event::PROC_EVENT_EXEC:
+                    events.push_back({Type::EXEC, (ull) event->event_data.exec.process_tgid});
+                    break;
+                case proc_event::PROC_EVENT_EXIT:
+                    if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid) {
+                        events.push_back({Type::EXIT, (ull) event->event_data.exit.process_tgid});
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef _PROC_EVENTS_H
+#define _PROC_EVENTS_H
+
+#include <vector>
+
+using namespace std;
+
+/*
+ * Follows processes being forked, exec'd and exiting through the proc connector of netlink, so that the set of
+ * processes is known without listing /proc. Subscribing needs CAP_NET_ADMIN and a kernel with CONFIG_PROC_EVENTS,
+ * callers check isListening and list /proc as before if it is false. Only processes are reported, not threads.
+ */
+class ProcEvents {
+public:
+    using ull = unsigned long long;
+
+    enum class Type {
+        FORK,
+        EXEC,
+        EXIT,
+    };
+
+    struct Event {
+        Type type;
+        ull pid;
+    };
+
+private:
+    int socket = -1;
+    vector<char> buffer;
+
+public:
+    ProcEvents();
+
+    ~ProcEvents();
+
+    ProcEvents(const ProcEvents &) = delete;
+
+    ProcEvents &operator=(const ProcEvents &) = delete;
+
+    bool isListening() const;
+
+    // appends what happened since the last call in order, never blocks; false if the kernel had to drop some as
+    // they were not read in time, then the set of processes is only known by listing /proc again
+    bool read(vector<Event> &events);
+};
+
+#endif // _PROC_EVENTS_H
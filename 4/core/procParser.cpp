@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+#include "procParser.h"
+
+ProcParser::ProcParser() : buffer(4096) {}
+
+string_view ProcParser::read(const char *path) {
+    auto fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return {};
+    }
+    auto data = read(fd);
+    close(fd);
+    return data;
+}
+
+string_view ProcParser::read(int fd) {
+    size_t size = 0;
+    while (true) {
+        if (size == buffer.size()) { // files of /proc have no size, grow until read returns 0
+            buffer.resize(buffer.size() * 2);
+        }
+        auto n = pread(fd, buffer.data() + size, buffer.size() - size, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) { // e.g. ESRCH once the process is gone
+            return {};
+        }
+        if (n == 0) {
+            break;
+        }
+        size += n;
+    }
+    return {buffer.data(), size};
+}
+
+string_view ProcParser::nextToken(string_view &data, char delimiter) {
+    auto start = data.find_first_not_of(delimiter);
+    if (start == string_view::npos) {
+        data = {};
+        return {};
+    }
+    auto end = data.find(delimiter, start);
+    auto token = data.substr(start, end == string_view::npos ? string_view::npos : end - start);
+    data.remove_prefix(end == string_view::npos ? data.size() : end + 1);
+    return token;
+}
+
+ProcParser::ull ProcParser::parseNumber(string_view data) {
+    auto start = data.find_first_of("0123456789");
+    ull value = 0;
+    if (start != string_view::npos) {
+        from_chars(data.data() + start, data.data() + data.size(), value);
+    }
+    return value;
+}
+
+template<typename T>
+static bool parseField(string_view token, T &value) {
+    auto[end, error] = from_chars(token.data(), token.data() + token.size(), value);
+    return error == errc() && end == token.data() + token.size();
+}
+
+bool ProcParser::parseStat(string_view data, Stat &stat) {
+    // pid (comm) state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime cutime cstime
+    // priority nice num_threads itrealvalue starttime ..., comm is whatever the process named itself, so it is found
+    // by the last ')'
+    auto open = data.find('(');
+    auto close = data.rfind(')');
+    if (open == string_view::npos || close == string_view::npos || close < open) {
+        return false;
+    }
+    auto pid = data.substr(0, open);
+    if (!parseField(pid.substr(0, pid.find_last_not_of(' ') + 1), stat.pid)) {
+        return false;
+    }
+    stat.name = data.substr(open + 1, close - open - 1);
+    data.remove_prefix(close + 1);
+    auto field = 3; // counted from 1 like proc(5)
+    for (auto token = nextToken(data); !token.empty() && field <= 22; token = nextToken(data), field++) {
+        auto ok = true;
+        switch (field) {
+            case 3:
+                stat.state = token[0];
+                break;
+            case 4:
+                ok = parseField(token, stat.parentPid);
+                break;
+            case 14:
+                ok = parseField(token, stat.userTime);
+                break;
+            case 15:
+                ok = parseField(token, stat.systemTime);
+                break;
+            case 18:
+                ok = parseField(token, stat.priority);
+                break;
+            case 19:
+                ok = parseField(token, stat.nice);
+                break;
+            case 22:
+                ok = parseField(token, stat.startTime);
+                break;
+            default:
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return field > 22;
+}
+
+void ProcParser::parseStatus(string_view data, Status &status) {
+    // "Key:\tvalue\n" lines, memory is in kB
+    for (auto line = nextToken(data, '\n'); !line.empty(); line = nextToken(data, '\n')) {
+        if (line.starts_with("Name:")) {
+            line.remove_prefix(5);
+            status.name = line.substr(min(line.find_first_not_of(" \t"), line.size()));
+        } else if (line.starts_with("Uid:")) {
+            status.uid = parseNumber(line); // the real one comes first
+        } else if (line.starts_with("VmSize:")) {
+            status.virtualMemory = parseNumber(line) * 1000;
+        } else if (line.starts_with("VmRSS:")) {
+            status.physicalMemory = parseNumber(line) * 1000;
+        } else if (line.starts_with("RssFile:")) {
+            status.sharedMemory += parseNumber(line) * 1000;
+        } else if (line.starts_with("RssShmem:")) {
+            status.sharedMemory += parseNumber(line) * 1000;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef _PROC_PARSER_H
+#define _PROC_PARSER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Reads files of /proc into one reusable buffer and parses them in place, no string is made for a field
+class ProcParser {
+public:
+    using ull = unsigned long long;
+
+    struct Stat { // of /proc/<pid>/stat
+        ull pid;
+        string_view name; // between the first '(' and the last ')', it may have spaces and parentheses itself
+        char state;
+        ull parentPid;
+        ull userTime; // clock ticks
+        ull systemTime;
+        long long priority;
+        long long nice;
+        ull startTime; // clock ticks after boot, tells a process from an earlier one with the same pid
+    };
+
+    struct Status { // of /proc/<pid>/status, memory in bytes
+        string_view name;
+        ull uid;
+        ull virtualMemory;
+        ull physicalMemory;
+        ull sharedMemory; // RssFile + RssShmem
+    };
+
+private:
+    vector<char> buffer;
+
+public:
+    ProcParser();
+
+    // the whole file, valid until the next read; empty if it cannot be read, e.g. the process is gone
+    string_view read(const char *path);
+
+    string_view read(int fd); // like above, from the start of a file kept open, which gives what it has now
+
+    static bool parseStat(string_view data, Stat &stat); // false if data is not a stat line
+
+    static void parseStatus(string_view data, Status &status); // lines missing in data leave fields as they are
+
+    static string_view nextToken(string_view &data, char delimiter = ' '); // skips delimiters before it
+
+    static ull parseNumber(string_view data); // the first number in data, 0 if there is none
+};
+
+#endif // _PROC_PARSER_H
@@ -0,0 +1,49 @@
+#include <iostream>
+
+#include "sampler.h"
+
+Sampler::Sampler(Monitor &monitor, chrono::milliseconds interval) : monitor(monitor), interval(interval) {
+    worker = thread(&Sampler::run, this);
+}
+
+Sampler::~Sampler() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    wakeUp.notify_one();
+    worker.join();
+}
+
+void Sampler::run() {
+    auto next = chrono::steady_clock::now();
+    unique_lock guard(lock);
+    while (!stopping) {
+        guard.unlock();
+        try {
+            publish(monitor.sample());
+        } catch (exception &e) { // e.g. a file of /proc that cannot be parsed, the next tick may do better
+            cerr << e.what() << endl;
+        }
+        guard.lock();
+        // ticks stay on the grid of interval, one that took longer than that is not made up for
+        next = max(next + interval, chrono::steady_clock::now());
+        wakeUp.wait_until(guard, next, [this] { return stopping; });
+    }
+}
+
+void Sampler::publish(shared_ptr<const Monitor::Snapshot> snapshot) {
+    slots[back] = move(snapshot);
+    // release, so the reader sees the snapshot once it sees the slot; acquire, so the slot taken back is no longer
+    // read by the reader
+    back = middle.exchange(back | FRESH, memory_order_acq_rel) & ~FRESH;
+    slots[back].reset(); // an older snapshot is freed here, not on the reader's thread
+}
+
+shared_ptr<const Monitor::Snapshot> Sampler::take() {
+    if (!(middle.load(memory_order_relaxed) & FRESH)) {
+        return nullptr;
+    }
+    front = middle.exchange(front, memory_order_acq_rel) & ~FRESH;
+    return slots[front];
+}
@@ -0,0 +1,47 @@
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "monitor.h"
+
+using namespace std;
+
+/*
+ * Samples a monitor on a thread of its own and hands the snapshots over to a single reader, e.g. the GUI.
+ * The handoff is a triple buffer: the sampler fills its slot and swaps it with the middle one, the reader
+ * swaps the middle one with its own when it is newer. Neither side ever waits for the other, a reader that
+ * is too slow only misses snapshots and a sampler that is too slow only makes the reader see nothing new.
+ */
+class Sampler {
+private:
+    const static unsigned FRESH = 4; // set in middle when the sampler swapped since the reader did
+
+    Monitor &monitor;
+    chrono::milliseconds interval;
+    shared_ptr<const Monitor::Snapshot> slots[3];
+    unsigned back = 0; // slot of the sampler
+    atomic<unsigned> middle = 1; // slot in between, and FRESH
+    unsigned front = 2; // slot of the reader
+    bool stopping = false;
+    mutex lock; // only guards stopping, sampling and the handoff run without it
+    condition_variable wakeUp;
+    thread worker;
+
+    void run();
+
+    void publish(shared_ptr<const Monitor::Snapshot> snapshot);
+
+public:
+    Sampler(Monitor &monitor, chrono::milliseconds interval); // the first sample is taken right away
+
+    ~Sampler();
+
+    // the latest snapshot if there is one the reader has not taken yet, nullptr otherwise; for one thread only
+    shared_ptr<const Monitor::Snapshot> take();
+};
+
+#endif // _SAMPLER_H
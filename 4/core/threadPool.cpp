@@ -0,0 +1,134 @@
+#include "threadPool.h"
+
+static uint64_t pack(uint64_t first, uint64_t end) {
+    return first << 32 | end;
+}
+
+static uint64_t getFirst(uint64_t range) {
+    return range >> 32;
+}
+
+static uint64_t getEnd(uint64_t range) {
+    return range & 0xffffffff;
+}
+
+ThreadPool::ThreadPool(size_t workers) : shares(make_unique<Share[]>(max(workers, (size_t) 1))),
+                                         workers(max(workers, (size_t) 1)) {
+    for (size_t i = 1; i < this->workers; i++) {
+        threads.emplace_back(&ThreadPool::loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    started.notify_all();
+    for (auto &t: threads) {
+        t.join();
+    }
+}
+
+size_t ThreadPool::getWorkers() const {
+    return workers;
+}
+
+bool ThreadPool::take(size_t worker, size_t &index) {
+    auto &range = shares[worker].range;
+    auto current = range.load(memory_order_relaxed);
+    while (getFirst(current) < getEnd(current)) {
+        if (range.compare_exchange_weak(current, pack(getFirst(current) + 1, getEnd(current)))) {
+            index = getFirst(current);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::steal(size_t worker) {
+    while (true) {
+        // the largest share left is the one most likely to keep its owner busy after everyone else is done
+        size_t victim = worker;
+        uint64_t largest = 0, current = 0;
+        for (size_t i = 0; i < workers; i++) {
+            auto range = shares[i].range.load(memory_order_relaxed);
+            if (i != worker && getEnd(range) > getFirst(range) && getEnd(range) - getFirst(range) > largest) {
+                victim = i;
+                largest = getEnd(range) - getFirst(range);
+                current = range;
+            }
+        }
+        if (victim == worker) {
+            return false;
+        }
+        auto first = getFirst(current), end = getEnd(current);
+        auto middle = end - (end - first + 1) / 2; // a single index left is taken as well
+        if (shares[victim].range.compare_exchange_strong(current, pack(first, middle))) {
+            // nobody else changes an empty share, so this cannot race with other thieves
+            shares[worker].range.store(pack(middle, end));
+            return true;
+        }
+    }
+}
+
+void ThreadPool::work(size_t worker) {
+    try {
+        size_t index;
+        while (take(worker, index) || (steal(worker) && take(worker, index))) {
+            (*task)(worker, index);
+        }
+    } catch (...) {
+        lock_guard guard(lock);
+        if (!error) {
+            error = current_exception();
+        }
+        for (size_t i = 0; i < workers; i++) { // the rest is skipped
+            shares[i].range.store(0);
+        }
+    }
+}
+
+void ThreadPool::loop(size_t worker) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            unique_lock guard(lock);
+            started.wait(guard, [this, seen] { return stopping || round != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = round;
+        }
+        work(worker);
+        {
+            lock_guard guard(lock);
+            running--;
+        }
+        finished.notify_one();
+    }
+}
+
+void ThreadPool::run(size_t count, const Task &task) {
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < workers; i++) {
+        shares[i].range.store(pack(count * i / workers, count * (i + 1) / workers));
+    }
+    {
+        lock_guard guard(lock);
+        this->task = &task;
+        running = threads.size();
+        error = nullptr;
+        round++;
+    }
+    started.notify_all();
+    work(0);
+    unique_lock guard(lock);
+    finished.wait(guard, [this] { return running == 0; });
+    this->task = nullptr;
+    if (error) {
+        rethrow_exception(error);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+/*
+ * Runs a task for every index of a range on a fixed set of threads, the calling one included.
+ * Every worker starts with an even share of the range and takes indices from its front, a worker
+ * running out steals the back half of the largest share left, so a few slow indices do not keep
+ * the others idle.
+ */
+class ThreadPool {
+public:
+    using Task = function<void(size_t worker, size_t index)>;
+
+private:
+    struct alignas(64) Share { // of one worker, on its own cache line as it changes on every index
+        atomic<uint64_t> range; // first index in the high half, end in the low one
+    };
+
+    unique_ptr<Share[]> shares;
+    size_t workers;
+    vector<thread> threads; // workers but the calling one
+    const Task *task = nullptr;
+    uint64_t round = 0; // of run, threads wait for it to change
+    size_t running = 0; // threads not done with the round
+    bool stopping = false;
+    exception_ptr error; // the first one thrown by task
+    mutex lock; // guards all of the above but shares
+    condition_variable started;
+    condition_variable finished;
+
+    bool take(size_t worker, size_t &index);
+
+    bool steal(size_t worker);
+
+    void work(size_t worker);
+
+    void loop(size_t worker);
+
+public:
+    explicit ThreadPool(size_t workers); // 0 is taken as 1, which runs everything on the calling thread
+
+    ~ThreadPool();
+
+    size_t getWorkers() const;
+
+    void run(size_t count, const Task &task); // returns once task ran for every index, rethrows its error
+};
+
+#endif // _THREAD_POOL_H
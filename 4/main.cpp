@@ -5,7 +5,16 @@
 
 int main(int argc, char *argv[]) {
     QApplication app(argc, argv);
-    MainWindow window;
+    size_t threads = thread::hardware_concurrency();
+    auto followEvents = false;
+    for (auto i = 1; i < argc; i++) { // Qt has taken its own options out of argv
+        if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoul(argv[++i]);
+        } else if (string(argv[i]) == "--events") {
+            followEvents = true;
+        }
+    }
+    MainWindow window(threads, followEvents);
     window.show();
     return app.exec();
 }
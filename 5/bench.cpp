@@ -0,0 +1,281 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <atomic>
+#include <new>
+
+#include "core/fs.h"
+#include "utils/utils.h"
+
+// runs repeatable workloads on a temporary image and reports throughput, latency and block I/O of every one
+
+static atomic<uint64_t> allocations = 0; // heap allocations of the whole program
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (auto data = malloc(size == 0 ? 1 : size)) {
+        return data;
+    }
+    throw bad_alloc();
+}
+
+void *operator new(size_t size, align_val_t alignment) {
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (auto data = aligned_alloc((size_t) alignment, (size + (size_t) alignment - 1) & ~((size_t) alignment - 1))) {
+        return data;
+    }
+    throw bad_alloc();
+}
+
+// all of them come from malloc, whatever the compiler assumes about operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void operator delete(void *data) noexcept { free(data); }
+
+void operator delete(void *data, size_t) noexcept { free(data); }
+
+void operator delete(void *data, align_val_t) noexcept { free(data); }
+
+void operator delete(void *data, size_t, align_val_t) noexcept { free(data); }
+
+#pragma GCC diagnostic pop
+
+struct Result {
+    string name;
+    size_t ops;
+    size_t bytes; // file data moved, 0 for metadata workloads
+    double seconds; // including the sync that puts buffered data on disk
+    Histogram latency; // ns of every op
+    uint64_t readBlocks;
+    uint64_t writtenBlocks;
+    uint64_t allocations; // by the ops themselves, the harness allocates nothing while they run
+};
+
+class Bench {
+private:
+    FileSystem &fs;
+    DiskStats &disk;
+    size_t files;
+    mt19937_64 random{42}; // fixed, so that runs are comparable
+    vector<unique_ptr<Result>> results;
+
+    string makeData(size_t size) {
+        string data(size, '\0');
+        for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            auto word = random();
+            memcpy(&data[i], &word, sizeof(uint64_t));
+        }
+        return data;
+    }
+
+    vector<size_t> shuffled(size_t count) {
+        vector<size_t> order(count);
+        iota(order.begin(), order.end(), 0);
+        shuffle(order.begin(), order.end(), random);
+        return order;
+    }
+
+    // times op(i) for every i in order, then a sync, which belongs to the workload as well
+    void run(const string &name, const vector<size_t> &order, size_t bytesPerOp, const function<void(size_t)> &op) {
+        auto &result = *results.emplace_back(make_unique<Result>());
+        result.name = name;
+        result.ops = order.size();
+        result.bytes = bytesPerOp * order.size();
+        auto readBlocks = disk.readBlocks.load(), writtenBlocks = disk.writtenBlocks.load();
+        auto start = chrono::steady_clock::now();
+        auto allocated = allocations.load();
+        for (auto i: order) {
+            auto begin = chrono::steady_clock::now();
+            op(i);
+            result.latency.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+        }
+        result.allocations = allocations - allocated;
+        fs.sync();
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        result.readBlocks = disk.readBlocks - readBlocks;
+        result.writtenBlocks = disk.writtenBlocks - writtenBlocks;
+    }
+
+    static vector<string> makePaths(const string &prefix, size_t count) { // before timing, so ops only look them up
+        vector<string> paths(count);
+        for (size_t i = 0; i < count; i++) {
+            paths[i] = prefix + to_string(i);
+        }
+        return paths;
+    }
+
+    void metadata() {
+        vector<size_t> order(files);
+        iota(order.begin(), order.end(), 0);
+        auto paths = makePaths("/meta/f", files);
+        fs.createFile("/meta/");
+        run("create", order, 0, [this, &paths](size_t i) { fs.createFile(paths[i]); });
+        run("stat", shuffled(files), 0, [this, &paths](size_t i) { fs.statFile(paths[i]); });
+        run("list", vector<size_t>(20), 0, [this](size_t) { fs.listDirectory("/meta"); });
+        run("du", vector<size_t>(20), 0, [this](size_t) { fs.diskUsage("/"); });
+        run("unlink", shuffled(files), 0, [this, &paths](size_t i) { fs.removeFile(paths[i]); });
+        fs.removeFile("/meta");
+    }
+
+    void lookup() {
+        string path;
+        for (auto i = 0; i < 16; i++) {
+            path += "/d" + to_string(i);
+            fs.createFile(path + "/");
+        }
+        path += "/leaf";
+        fs.createFile(path);
+        run("lookup-16", vector<size_t>(files), 0, [this, &path](size_t) { fs.statFile(path); });
+        fs.removeFile("/d0");
+    }
+
+    void data(size_t size, const string &label) {
+        auto count = max((size_t) 1, min(files, TOTAL_BYTES / size));
+        auto paths = makePaths("/data/f", count);
+        vector<string> contents(2); // files take turns, generating data is not timed
+        for (auto &content: contents) {
+            content = makeData(size);
+        }
+        vector<size_t> order(count);
+        iota(order.begin(), order.end(), 0);
+        fs.createFile("/data/");
+        for (auto &path: paths) {
+            fs.createFile(path);
+        }
+        run("seqwrite-" + label, order, size, [&](size_t i) { fs.writeFile(paths[i], contents[i % 2]); });
+        run("seqread-" + label, order, size, [&](size_t i) { fs.readFile(paths[i]); });
+        run("randwrite-" + label, shuffled(count), size, [&](size_t i) { fs.writeFile(paths[i], contents[(i + 1) % 2]); });
+        run("randread-" + label, shuffled(count), size, [&](size_t i) { fs.readFile(paths[i]); });
+        fs.removeFile("/data");
+    }
+
+    void removeTree() {
+        fs.createFile("/tree/");
+        auto directories = max((size_t) 1, files / 16);
+        for (size_t i = 0; i < directories; i++) {
+            fs.createFile("/tree/d" + to_string(i) + "/");
+        }
+        for (size_t i = 0; i < files - directories; i++) {
+            fs.createFile("/tree/d" + to_string(i % directories) + "/f" + to_string(i));
+            fs.writeFile("/tree/d" + to_string(i % directories) + "/f" + to_string(i), "data");
+        }
+        fs.sync();
+        // a single op like the other rows, its cost grows with the files entries of the tree
+        run("rm-r", vector<size_t>(1), 0, [this](size_t) { fs.removeFile("/tree"); });
+    }
+
+public:
+    const static size_t TOTAL_BYTES = 16 * 1024 * 1024; // written by every data workload, fewer files if it is less
+
+    Bench(FileSystem &fs, DiskStats &disk, size_t files) : fs(fs), disk(disk), files(files) {}
+
+    void runAll() {
+        metadata();
+        lookup();
+        data(4 * 1024, "4K");
+        data(64 * 1024, "64K");
+        data(1024 * 1024, "1M");
+        removeTree();
+    }
+
+    void print() {
+        cout << left << setw(16) << "workload" << right << setw(8) << "ops" << setw(12) << "ops/s" << setw(10) << "MB/s"
+             << setw(10) << "p50(us)" << setw(10) << "p99(us)" << setw(10) << "reads" << setw(10) << "writes"
+             << setw(10) << "allocs" << endl;
+        cout << fixed << setprecision(1);
+        for (auto &result: results) {
+            cout << left << setw(16) << result->name << right << setw(8) << result->ops
+                 << setw(12) << result->ops / result->seconds << setw(10) << result->bytes / result->seconds / MB
+                 << setw(10) << result->latency.percentile(0.5) / 1000.0
+                 << setw(10) << result->latency.percentile(0.99) / 1000.0
+                 << setw(10) << (double) result->readBlocks / result->ops
+                 << setw(10) << (double) result->writtenBlocks / result->ops
+                 << setw(10) << (double) result->allocations / result->ops << endl; // blocks and allocations per op
+        }
+        cout << defaultfloat;
+    }
+
+    void dump(ostream &out, size_t blockSize, bool deduplication) {
+        out << "{\"blockSize\":" << blockSize << ",\"deduplication\":" << (deduplication ? "true" : "false")
+            << ",\"files\":" << files << ",\"workloads\":[";
+        for (size_t i = 0; i < results.size(); i++) {
+            auto &result = *results[i];
+            auto summary = result.latency.summarize();
+            out << (i == 0 ? "" : ",") << "{\"name\":\"" << result.name << "\",\"ops\":" << result.ops
+                << ",\"seconds\":" << result.seconds << ",\"opsPerSecond\":" << result.ops / result.seconds
+                << ",\"bytesPerSecond\":" << result.bytes / result.seconds
+                << ",\"p50Ns\":" << summary.p50 << ",\"p99Ns\":" << summary.p99 << ",\"maxNs\":" << summary.max
+                << ",\"readBlocksPerOp\":" << (double) result.readBlocks / result.ops
+                << ",\"writtenBlocksPerOp\":" << (double) result.writtenBlocks / result.ops
+                << ",\"allocationsPerOp\":" << (double) result.allocations / result.ops << "}";
+        }
+        out << "]}" << endl;
+    }
+};
+
+int main(int argc, char *argv[]) {
+    size_t files = 1000, blockSize = Disk::BLOCK_SIZE, size = 128; // MiB of the image
+    auto deduplication = false, keepImage = false; // an image given is left for inspection
+    string jsonPath, imagePath = (filesystem::temp_directory_path() / "bfs_bench.img").string();
+    for (auto i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--dedup") {
+            deduplication = true;
+        } else if (arg == "--files" && i + 1 < argc) {
+            files = stoul(argv[++i]);
+        } else if (arg == "--block-size" && i + 1 < argc) {
+            blockSize = stoul(argv[++i]);
+        } else if (arg == "--size" && i + 1 < argc) {
+            size = stoul(argv[++i]);
+        } else if (arg == "--image" && i + 1 < argc) {
+            imagePath = argv[++i];
+            keepImage = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--files <n>] [--block-size <4096|16384|65536>] [--dedup]"
+                 << " [--size <MiB>] [--image <diskFilePath>] [--json <jsonFilePath>]" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    try {
+        { // a fresh image every run
+            ofstream image(imagePath, ios::binary | ios::trunc);
+        }
+        filesystem::resize_file(imagePath, size * 1024 * 1024);
+        Disk disk(imagePath.c_str());
+        FileSystem fs(disk);
+        fs.format(blockSize, deduplication);
+        auto inodes = fs.statSpace().totalInodes;
+        if (inodes <= 32) { // directories of the workloads need a few
+            throw runtime_error("Only " + to_string(inodes) + " inodes, the image is too small");
+        }
+        if (files + 32 > inodes) {
+            files = inodes - 32;
+            cerr << "Only " << inodes << " inodes, running with " << files << " files" << endl;
+        }
+        Bench bench(fs, disk.getStats(), files);
+        bench.runAll();
+        fs.unmount();
+        bench.print();
+        if (!jsonPath.empty()) {
+            ofstream json(jsonPath);
+            if (json.fail()) {
+                throw runtime_error("Unable to open " + jsonPath);
+            }
+            bench.dump(json, blockSize, deduplication);
+        }
+    } catch (runtime_error &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    if (!keepImage) {
+        filesystem::remove(imagePath);
+    }
+    return EXIT_SUCCESS;
+}
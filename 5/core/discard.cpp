@@ -0,0 +1,68 @@
+#include <iostream>
+
+#include "discard.h"
+
+Discarder::Discarder(Disk &disk) : disk(disk), pending(disk.size()) {
+    worker = thread(&Discarder::run, this);
+}
+
+Discarder::~Discarder() {
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    wakeUp.notify_one();
+    worker.join();
+}
+
+void Discarder::add(size_t location) {
+    lock_guard guard(lock);
+    if (!pending[location]) {
+        pending[location] = true;
+        pendingCount++;
+    }
+    lastFreed = chrono::steady_clock::now();
+    if (pendingCount >= BATCH_BLOCKS) {
+        wakeUp.notify_one();
+    }
+}
+
+void Discarder::cancel(size_t location) {
+    lock_guard guard(lock);
+    if (pending[location]) {
+        pending[location] = false;
+        pendingCount--;
+    }
+}
+
+void Discarder::run() {
+    unique_lock guard(lock);
+    while (!stopping) {
+        wakeUp.wait(guard, [this] { return stopping || pendingCount > 0; });
+        // blocks freed in the meantime push the deadline back, which is only noticed once the old one is reached
+        auto deadline = lastFreed + chrono::seconds(IDLE_SECONDS);
+        auto batched = wakeUp.wait_until(guard, deadline, [this] { return stopping || pendingCount >= BATCH_BLOCKS; });
+        auto idle = chrono::steady_clock::now() >= lastFreed + chrono::seconds(IDLE_SECONDS);
+        if (pendingCount > 0 && (batched || idle)) {
+            discardPending();
+        }
+    }
+}
+
+void Discarder::discardPending() {
+    try {
+        for (size_t i = 0, j; i < pending.size(); i = j) { // merge adjacent blocks into ranges
+            for (; i < pending.size() && !pending[i]; i++);
+            for (j = i; j < pending.size() && pending[j]; j++) {
+                pending[j] = false;
+            }
+            if (j > i) {
+                disk.discard(i, j - i);
+            }
+        }
+    } catch (runtime_error &e) { // e.g. not supported by the underlying filesystem
+        cerr << e.what() << endl;
+        fill(pending.begin(), pending.end(), false);
+    }
+    pendingCount = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef _DISCARD_H
+#define _DISCARD_H
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "disk.h"
+
+using namespace std;
+
+/*
+ * Punches holes in the disk image for freed blocks from a background thread.
+ * Freed blocks are collected and discarded in large batches of adjacent ranges,
+ * a block which gets allocated again before that is simply taken off the list.
+ */
+class Discarder {
+private:
+    Disk &disk;
+    vector<bool> pending; // block location -> waiting to be discarded
+    size_t pendingCount = 0;
+    chrono::steady_clock::time_point lastFreed; // the idle time is counted from here
+    bool stopping = false;
+    mutex lock; // also held while discarding, so a reallocated block is never punched after being written
+    condition_variable wakeUp;
+    thread worker;
+
+    void run();
+
+    void discardPending();
+
+public:
+    static constexpr size_t BATCH_BLOCKS = 256; // discard once this many blocks are freed
+    static constexpr size_t IDLE_SECONDS = 5; // or when nothing was freed for this long
+
+    explicit Discarder(Disk &disk);
+
+    ~Discarder();
+
+    void add(size_t location);
+
+    void cancel(size_t location);
+};
+
+#endif // _DISCARD_H
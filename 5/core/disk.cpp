@@ -4,12 +4,20 @@
 #include <unistd.h>
 #include <filesystem>
 
+Disk::Disk() : fd(-1), capacity(0), _mounted(false), blocks(0) {}
+
 Disk::Disk(const char *path) : _mounted(false) {
     fd = open(path, O_RDWR | O_CREAT, 0600);
     if (fd < 0) {
         throw runtime_error("Unable to open disk");
     }
-    blocks = filesystem::file_size(path) / BLOCK_SIZE;
+    capacity = filesystem::file_size(path);
+    blocks = capacity / blockSize;
+}
+
+void Disk::setBlockSize(size_t size) {
+    blockSize = size;
+    blocks = capacity / blockSize;
 }
 
 Disk::~Disk() {
@@ -19,38 +27,53 @@ Disk::~Disk() {
     }
 }
 
-void Disk::checkParams(unsigned int index, const char *data) {
-    if (index >= blocks) {
-        throw runtime_error("Invalid block index");
-    }
-
-    if (data == nullptr) {
+size_t Disk::checkParams(unsigned int index, span<const char> data) {
+    if (data.data() == nullptr) {
         throw runtime_error("Null data pointer");
     }
-}
 
-void Disk::read(unsigned int index, char *data) {
-    checkParams(index, data);
+    if (data.empty() || data.size() % blockSize != 0) {
+        throw runtime_error("Data should be whole blocks");
+    }
 
-    if (lseek(fd, index * BLOCK_SIZE, SEEK_SET) < 0) {
-        throw runtime_error("Unable to lseek block " + to_string(index));
+    auto count = data.size() / blockSize;
+    if (index >= blocks || count > blocks - index) {
+        throw runtime_error("Invalid block index");
     }
+    return count;
+}
+
+void Disk::read(unsigned int index, span<char> data) {
+    auto count = checkParams(index, data);
 
-    if (::read(fd, data, BLOCK_SIZE) != BLOCK_SIZE) {
+    auto start = chrono::steady_clock::now();
+    auto length = (ssize_t) data.size();
+    if (pread(fd, data.data(), length, (off_t) index * blockSize) != length) {
         throw runtime_error("Unable to read block " + to_string(index));
     }
+    stats.recordRead(count, length, start);
 }
 
-void Disk::write(unsigned int index, char *data) {
-    checkParams(index, data);
+void Disk::write(unsigned int index, span<const char> data) {
+    auto count = checkParams(index, data);
+
+    auto start = chrono::steady_clock::now();
+    auto length = (ssize_t) data.size();
+    if (pwrite(fd, data.data(), length, (off_t) index * blockSize) != length) {
+        throw runtime_error("Unable to write block " + to_string(index));
+    }
+    stats.recordWrite(count, length, start);
+}
 
-    if (lseek(fd, index * BLOCK_SIZE, SEEK_SET) < 0) {
-        throw runtime_error("Unable to lseek block " + to_string(index));
+void Disk::discard(unsigned int index, size_t count) {
+    if (index >= blocks || count > blocks - index) {
+        throw runtime_error("Invalid block index");
     }
 
-    if (::write(fd, data, BLOCK_SIZE) != BLOCK_SIZE) {
-        throw runtime_error("Unable to write block " + to_string(index));
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) index * blockSize, count * blockSize) < 0) {
+        throw runtime_error("Unable to discard block " + to_string(index));
     }
+    stats.recordDiscard(count);
 }
 
 void Disk::mount() {
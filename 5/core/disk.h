@@ -3,35 +3,64 @@
 
 #include <stdexcept>
 #include <cstring>
+#include <span>
+
+#include "stats.h"
 
 using namespace std;
 
 class Disk {
+public:
+    const static size_t BLOCK_SIZE = 4096; // default and smallest block size
+
 private:
     int fd;
+    size_t capacity; // in bytes
     bool _mounted;
+
+protected:
+    size_t blockSize = BLOCK_SIZE;
     size_t blocks;
+    DiskStats stats; // of requests to this disk as a whole, members of a striped disk keep their own
 
-    void checkParams(unsigned int index, const char *data);
+    Disk(); // for disks which are not backed by a single image
 
-public:
-    const static size_t BLOCK_SIZE = 4096;
+    // returns the number of blocks `data` spans
+    size_t checkParams(unsigned int index, span<const char> data);
 
+public:
     explicit Disk(const char *path);
 
-    ~Disk();
+    virtual ~Disk();
 
     [[nodiscard]] size_t size() const { return blocks; }
 
+    [[nodiscard]] size_t getBlockSize() const { return blockSize; }
+
+    // how blocks are spread over images, 1 image and 0 blocks per stripe unit if they are not
+    [[nodiscard]] virtual size_t getMembers() const { return 1; }
+
+    [[nodiscard]] virtual size_t getStripeBlocks() const { return 0; }
+
+    // all indices and counts are in blocks of this size afterwards
+    virtual void setBlockSize(size_t size);
+
     [[nodiscard]] bool mounted() const { return _mounted; }
 
+    [[nodiscard]] DiskStats &getStats() { return stats; }
+
     void mount();
 
     void unmount();
 
-    void read(unsigned int index, char *data);
+    // read/write as many consecutive blocks as `data` spans starting from `index` with a single I/O
+    // safe to be called from multiple threads
+    virtual void read(unsigned int index, span<char> data);
+
+    virtual void write(unsigned int index, span<const char> data);
 
-    void write(unsigned int index, char *data);
+    // give the space of `count` blocks starting from `index` back to the host, they are read as zeros afterwards
+    virtual void discard(unsigned int index, size_t count);
 };
 
 #endif // _DISK_H
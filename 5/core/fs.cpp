@@ -1,11 +1,21 @@
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+
 #include "fs.h"
 #include "../utils/utils.h"
 
-FileSystem::FileSystem(Disk &disk) : superBlock(SuperBlock()), disk(disk) {
+template<size_t BLOCK_SIZE>
+BlockFileSystem<BLOCK_SIZE>::BlockFileSystem(Disk &disk) : disk(disk), superBlock(SuperBlock()) {
     if (disk.size() < 16) {
         throw runtime_error("Disk size too small");
     }
     superBlock.magicNumber = MAGIC_NUMBER;
+    superBlock.blockSize = BLOCK_SIZE;
+    superBlock.stripeMembers = disk.getMembers();
+    superBlock.stripeBlocks = disk.getStripeBlocks();
     superBlock.inodeBlocks = disk.size() / 16;
     superBlock.dataBlocks = disk.size() - superBlock.inodeBlocks - 3;
     superBlock.inodeOffset = 3;
@@ -14,40 +24,319 @@ FileSystem::FileSystem(Disk &disk) : superBlock(SuperBlock()), disk(disk) {
     blockMap.set();
 }
 
-void FileSystem::setInodeMap(size_t index, bool free) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setInodeMap(size_t index, bool free) {
+    markInode(index, free);
+    writeInodeMap();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::markInode(size_t index, bool free) { // only in memory, callers write InodeBitMap
+    if (inodeMap[index] != free) {
+        free ? superBlock.freeInodes++ : superBlock.freeInodes--;
+        free ? superBlock.groupFreeInodes[index / BITS_PER_GROUP]++ : superBlock.groupFreeInodes[index / BITS_PER_GROUP]--;
+    }
     free ? inodeMap.set(index) : inodeMap.reset(index);
-    Block block{};
-    block.inodeMap = inodeMap;
-    disk.write(1, block.data);
 }
 
-void FileSystem::setBlockMap(size_t index, bool free) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeInodeMap() {
+    auto buffer = pool.acquire();
+    buffer.as<Block>().inodeMap = inodeMap; // fills the whole block
+    disk.write(1, buffer.get());
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setBlockMap(size_t index, bool free) {
+    markBlock(index, free);
+    writeBlockMap();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::markBlock(size_t index, bool free) { // only in memory, callers write BlockBitMap
+    if (blockMap[index] != free) {
+        if (!references.empty()) { // a new block is owned by one pointer and not shared until it gets a fingerprint
+            auto &reference = references[index];
+            auto indexed = fingerprints.find(reference.fingerprint);
+            if (indexed != fingerprints.end() && indexed->second == index) {
+                fingerprints.erase(indexed);
+            }
+            reference = {0, free ? 0u : 1u};
+            dirtyReferences.insert(index / REFERENCE_COUNT_PER_BLOCK);
+        }
+        if (free && heldMap[index]) { // a snapshot still refers to it, kept until the snapshot is deleted
+            deadMap.set(index);
+            deadMapChanged = true;
+            return;
+        }
+        free ? superBlock.freeBlocks++ : superBlock.freeBlocks--;
+        free ? superBlock.groupFreeBlocks[index / BITS_PER_GROUP]++ : superBlock.groupFreeBlocks[index / BITS_PER_GROUP]--;
+        if (discarder) {
+            free ? discarder->add(getBlockLocation(index)) : discarder->cancel(getBlockLocation(index));
+        }
+    }
     free ? blockMap.set(index) : blockMap.reset(index);
-    Block block{};
-    block.blockMap = blockMap;
-    disk.write(2, block.data);
 }
 
-void FileSystem::format() {
-    if (currentUid != 0) {
-        throw runtime_error("Permission denied: formatting can only performed by root(uid 0)");
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeBlockMap() {
+    auto buffer = pool.acquire();
+    buffer.as<Block>().blockMap = blockMap; // fills the whole block
+    disk.write(2, buffer.get());
+    writeReferences(); // reference counts change together with BlockBitMap
+    if (deadMapChanged && superBlock.deadBlock != 0) { // so does DeadBitMap
+        buffer.as<Block>().blockMap = deadMap;
+        disk.write(superBlock.deadBlock, buffer.get());
+        deadMapChanged = false;
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::loadReferences() {
+    references.clear();
+    dirtyReferences.clear();
+    fingerprints.clear();
+    savedBlocks = 0;
+    lookups = hits = collisions = 0;
+    if (superBlock.referenceBlocks == 0) {
+        return;
+    }
+    references.resize(superBlock.referenceBlocks * REFERENCE_COUNT_PER_BLOCK);
+    disk.read(superBlock.referenceOffset,
+              {reinterpret_cast<char *>(references.data()), superBlock.referenceBlocks * BLOCK_SIZE});
+    for (size_t i = 0; i < superBlock.dataBlocks; i++) {
+        if (references[i].count > 1) {
+            savedBlocks += references[i].count - 1;
+        }
+        if (references[i].count > 0 && references[i].fingerprint != 0) {
+            fingerprints.emplace(references[i].fingerprint, i);
+        }
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeReferences() {
+    for (auto number: dirtyReferences) {
+        disk.write(superBlock.referenceOffset + number,
+                   {reinterpret_cast<const char *>(&references[number * REFERENCE_COUNT_PER_BLOCK]), BLOCK_SIZE});
+    }
+    dirtyReferences.clear();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::shareBlock(size_t index) { // only in memory, callers write BlockBitMap
+    references[index].count++;
+    savedBlocks++;
+    dirtyReferences.insert(index / REFERENCE_COUNT_PER_BLOCK);
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::releaseBlock(size_t index) { // only in memory, callers write BlockBitMap
+    if (!references.empty() && references[index].count > 1) { // still pointed to by other files
+        references[index].count--;
+        savedBlocks--;
+        dirtyReferences.insert(index / REFERENCE_COUNT_PER_BLOCK);
+        return;
+    }
+    markBlock(index, true);
+}
+
+template<size_t BLOCK_SIZE>
+uint32_t BlockFileSystem<BLOCK_SIZE>::fingerprint(const char *data) {
+    // four independent multiply-xor lanes over 64-bit words, so it runs at memory speed; collisions are verified
+    uint64_t lanes[4] = {0x9e3779b97f4a7c15, 0xc2b2ae3d27d4eb4f, 0x165667b19e3779f9, 0x27d4eb2f165667c5};
+    for (size_t i = 0; i < BLOCK_SIZE; i += 4 * sizeof(uint64_t)) {
+        for (size_t lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, data + i + lane * sizeof(uint64_t), sizeof(uint64_t));
+            lanes[lane] = (lanes[lane] ^ word) * 0xff51afd7ed558ccd;
+            lanes[lane] ^= lanes[lane] >> 32;
+        }
+    }
+    auto hash = lanes[0] ^ rotl(lanes[1], 16) ^ rotl(lanes[2], 32) ^ rotl(lanes[3], 48);
+    auto print = (uint32_t) (hash ^ hash >> 32);
+    return print == 0 ? 1 : print; // 0 marks blocks that are not shared
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::findDuplicate(const char *data, uint32_t print) {
+    lookups++;
+    auto indexed = fingerprints.find(print);
+    if (indexed == fingerprints.end() || references[indexed->second].count == UINT32_MAX) {
+        return SIZE_MAX;
+    }
+    auto candidate = pool.acquire();
+    disk.read(getBlockLocation(indexed->second), candidate.get());
+    if (memcmp(candidate.get().data(), data, BLOCK_SIZE) != 0) {
+        collisions++;
+        return SIZE_MAX;
+    }
+    hits++;
+    return indexed->second;
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::freeBlockCount() {
+    return superBlock.freeBlocks;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeSuperBlock() {
+    auto buffer = pool.acquire();
+    auto data = buffer.get();
+    fill(data.begin() + sizeof(SuperBlock), data.end(), 0);
+    buffer.as<Block>().super = superBlock;
+    disk.write(0, data);
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::getInodeCount() {
+    return superBlock.inodeBlocks; // checkInode accepts no more inodes than this
+}
+
+template<size_t BLOCK_SIZE>
+uint32_t BlockFileSystem<BLOCK_SIZE>::countBits(const char *bitmap, size_t from, size_t to) {
+    uint32_t count = 0;
+    for (auto i = from; i < to; i += 64) { // from is always aligned to a word
+        uint64_t word;
+        memcpy(&word, bitmap + i / 8, sizeof(uint64_t));
+        if (to - i < 64) {
+            word &= (1ull << (to - i)) - 1; // ignore bits out of range
+        }
+        count += popcount(word);
+    }
+    return count;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::rebuildCounters() {
+    auto inodeBitMap = pool.acquire(), blockBitMap = pool.acquire();
+    disk.read(1, inodeBitMap.get());
+    disk.read(2, blockBitMap.get());
+    superBlock.freeBlocks = 0;
+    superBlock.freeInodes = 0;
+    for (size_t group = 0; group < GROUP_COUNT; group++) {
+        auto from = group * BITS_PER_GROUP;
+        auto blocks = min(from + BITS_PER_GROUP, (size_t) superBlock.dataBlocks);
+        auto inodes = min(from + BITS_PER_GROUP, getInodeCount());
+        superBlock.groupFreeBlocks[group] = from < blocks ? countBits(blockBitMap.get().data(), from, blocks) : 0;
+        superBlock.groupFreeInodes[group] = from < inodes ? countBits(inodeBitMap.get().data(), from, inodes) : 0;
+        superBlock.freeBlocks += superBlock.groupFreeBlocks[group];
+        superBlock.freeInodes += superBlock.groupFreeInodes[group];
+    }
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::getBlockCount(size_t size) {
+    auto count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    return count > DIRECT_BLOCKS_PER_INODE ? count + 1 : count; // one more for indirect pointers
+}
+
+template<size_t BLOCK_SIZE>
+vector<size_t> BlockFileSystem<BLOCK_SIZE>::allocateBlocks(size_t count) {
+    vector<size_t> indices;
+    // prefer the first run of free blocks that is long enough to hold all of them
+    size_t start = blockMap._Find_first(), length = 0;
+    for (auto i = start; i < superBlock.dataBlocks && length < count; i = blockMap._Find_next(i)) {
+        if (i != start + length) {
+            start = i;
+            length = 0;
+        }
+        length++;
+    }
+    if (length == count) {
+        for (auto i = start; i < start + count; i++) {
+            indices.push_back(i);
+        }
+    } else { // fragmented, fall back to first fit
+        for (auto i = blockMap._Find_first(); indices.size() < count; i = blockMap._Find_next(i)) {
+            checkBlock(i);
+            indices.push_back(i);
+        }
+    }
+    for (auto i: indices) {
+        markBlock(i, false);
+    }
+    writeBlockMap(); // mark as used at once
+    return indices;
+}
+
+template<size_t BLOCK_SIZE>
+vector<uint32_t> BlockFileSystem<BLOCK_SIZE>::getPointers(const Inode &inode, size_t count) {
+    if (count > DIRECT_BLOCKS_PER_INODE + INDIRECT_BLOCKS_PER_INODE) { // a broken or half written inode
+        throw runtime_error("Inode is broken");
     }
-    { // write SuperBlock
-        Block block{};
-        block.super = superBlock;
-        disk.write(0, block.data);
+    vector<uint32_t> pointers(begin(inode.direct), begin(inode.direct) + min(count, (size_t) DIRECT_BLOCKS_PER_INODE));
+    if (count > DIRECT_BLOCKS_PER_INODE) {
+        if (inode.indirect == 0) { // a missing indirect blocks pointer leaves the rest as a hole
+            pointers.resize(count, 0);
+            return pointers;
+        }
+        auto buffer = pool.acquire();
+        auto &pointerBlock = buffer.as<Block>();
+        disk.read(inode.indirect, buffer.get());
+        pointers.insert(pointers.end(), begin(pointerBlock.pointers),
+                        begin(pointerBlock.pointers) + (count - DIRECT_BLOCKS_PER_INODE));
+    }
+    return pointers;
+}
+
+template<size_t BLOCK_SIZE>
+vector<size_t> BlockFileSystem<BLOCK_SIZE>::collectBlocks(const Inode &inode) {
+    vector<size_t> locations;
+    auto pointers = getPointers(inode, DIRECT_BLOCKS_PER_INODE + (inode.indirect != 0 ? INDIRECT_BLOCKS_PER_INODE : 0));
+    for (auto location: pointers) {
+        if (location != 0) { // skip holes
+            locations.push_back(location);
+        }
+    }
+    if (inode.indirect != 0) {
+        locations.push_back(inode.indirect); // indirect blocks pointer comes last
+    }
+    return locations;
+}
+
+template<size_t BLOCK_SIZE>
+bool BlockFileSystem<BLOCK_SIZE>::isZeroBlock(const char *data) {
+    // OR 64-bit words together instead of comparing bytes, which compilers turn into vector instructions
+    uint64_t accumulator = 0;
+    for (size_t i = 0; i < BLOCK_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        accumulator |= word;
+    }
+    return accumulator == 0;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::format(bool deduplication) {
+    if (deduplication) { // take reference blocks from data blocks, 8B for every remaining data block
+        auto rest = superBlock.dataBlocks + superBlock.referenceBlocks;
+        superBlock.referenceBlocks = (rest * sizeof(BlockReference) + BLOCK_SIZE + sizeof(BlockReference) - 1)
+                                     / (BLOCK_SIZE + sizeof(BlockReference));
+        superBlock.dataBlocks = rest - superBlock.referenceBlocks;
     }
+    superBlock.referenceOffset = superBlock.inodeOffset + superBlock.inodeBlocks;
+    superBlock.blockOffset = superBlock.referenceOffset + superBlock.referenceBlocks;
+    auto buffer = pool.acquire();
+    auto data = buffer.get();
+    fill(data.begin(), data.end(), ~0);
     for (auto i = 1; i < 3; i++) { // write InodeBitMap and BlockBitMap as all set
-        Block block{};
-        block.inodeMap.set();
-        disk.write(i, block.data);
+        disk.write(i, data);
     }
     inodeMap.set();
     blockMap.set();
-    Block emptyBlock{};
+    rebuildCounters();
+    superBlock.clean = 0; // stays dirty until unmount
+    writeSuperBlock();
+    dirtyData.clear();
+    dirtyBytes = 0;
+    dirtyBlocks = 0;
+    fill(data.begin(), data.end(), 0);
     for (auto i = 3; i < disk.size(); i++) { // write empty data to all other blocks
-        disk.write(i, emptyBlock.data);
+        disk.write(i, data);
     }
+    loadReferences(); // all zeros
     if (!disk.mounted()) {
         disk.mount();
     }
@@ -59,44 +348,465 @@ void FileSystem::format() {
     initDirectory(rootIndex, rootIndex);
 }
 
-void FileSystem::mount() {
-    Block block{};
-    disk.read(0, block.data); // read SuperBlock
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::mount(const string &snapshot, bool readOnly) {
+    auto buffer = pool.acquire();
+    auto &block = buffer.as<Block>();
+    disk.read(0, buffer.get()); // read SuperBlock
     if (block.super.magicNumber != MAGIC_NUMBER) {
         throw runtime_error("Unexpected magic number, you should format it first");
     }
+    // any other layout finds SuperBlock as well, but maps the rest of the blocks to the wrong places
+    auto &super = block.super;
+    if (super.stripeMembers != 0
+        && (super.stripeMembers != disk.getMembers() || super.stripeBlocks != disk.getStripeBlocks())) {
+        throw runtime_error("Stripe layout differs from the formatted one: " + to_string(super.stripeMembers)
+                            + " images, " + to_string(super.stripeBlocks) + " blocks per stripe unit");
+    }
+    superBlock = block.super;
+    dirtyData.clear();
+    dirtyBytes = 0;
+    dirtyBlocks = 0;
+    if (!snapshot.empty() || readOnly) { // nothing is written, maps are loaded by the first call and reloaded later
+        this->readOnly = true;
+        mountedSnapshot = snapshot;
+        viewGeneration = 1;
+        disk.mount();
+        try {
+            readConsistently([] { return true; }); // fails now if the snapshot does not exist
+        } catch (runtime_error &) {
+            unmount();
+            throw;
+        }
+        return;
+    }
     disk.mount();
+    disk.read(1, buffer.get());
+    inodeMap = block.inodeMap;
+    disk.read(2, buffer.get());
+    blockMap = block.blockMap;
+    loadReferences();
+    deadMap.reset();
+    if (superBlock.deadBlock != 0) {
+        disk.read(superBlock.deadBlock, buffer.get());
+        deadMap = block.blockMap;
+    }
+    loadSnapshots();
+    if (!superBlock.clean) { // not unmounted properly, or counters never saved
+        rebuildCounters();
+    }
+    superBlock.clean = 0;
+    superBlock.generation += superBlock.generation % 2; // a writer stopped in the middle of a change
+    writeSuperBlock();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::unmount() {
+    if (readOnly) {
+        readOnly = false;
+        mountedSnapshot.clear();
+        inodeRemap.clear();
+        disk.unmount();
+        return;
+    }
+    sync();
+    discarder.reset(); // discard what is left
+    superBlock.clean = 1;
+    writeSuperBlock();
+    disk.unmount();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::sync() {
+    Change change(*this);
+    if (!disk.mounted()) {
+        throw runtime_error("BFS is not mounted");
+    }
+    if (readOnly) {
+        return;
+    }
+    commitDirty();
+    for (auto index: sparseDirectories) { // moved out of removeFile, which only marks entries as free
+        compactDirectory(index);
+    }
+    sparseDirectories.clear();
+    writeSuperBlock(); // save counters
+}
+
+template<size_t BLOCK_SIZE>
+FileSystemBase::SpaceInfo BlockFileSystem<BLOCK_SIZE>::statSpace() {
+    if (!disk.mounted()) {
+        throw runtime_error("BFS is not mounted");
+    }
+    readConsistently([] { return true; }); // counters of SuperBlock as they are now
+    SpaceInfo info{
+        BLOCK_SIZE,
+        superBlock.dataBlocks,
+        (uint32_t) (superBlock.freeBlocks - dirtyBlocks),
+        (uint32_t) getInodeCount(),
+        superBlock.freeInodes,
+    };
+    auto groups = (max((size_t) superBlock.dataBlocks, getInodeCount()) + BITS_PER_GROUP - 1) / BITS_PER_GROUP;
+    groups = min(groups, (size_t) GROUP_COUNT);
+    for (size_t group = 0; group < groups; group++) {
+        info.groups.emplace_back(superBlock.groupFreeBlocks[group], superBlock.groupFreeInodes[group]);
+    }
+    info.deduplication = !references.empty();
+    info.savedBlocks = savedBlocks;
+    info.lookups = lookups;
+    info.hits = hits;
+    info.collisions = collisions;
+    return info;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setDiscard(bool enabled) {
+    if (!disk.mounted()) {
+        throw runtime_error("BFS is not mounted");
+    }
+    if (!enabled) {
+        discarder.reset();
+    } else if (!discarder) {
+        discarder = make_unique<Discarder>(disk);
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::checkWritable() {
+    if (readOnly) {
+        throw runtime_error("BFS is mounted read-only");
+    }
+}
+
+template<size_t BLOCK_SIZE>
+BlockFileSystem<BLOCK_SIZE>::Change::Change(BlockFileSystem &fs) : fs(fs) {
+    if (fs.changes++ == 0 && !fs.readOnly && fs.disk.mounted()) {
+        fs.superBlock.generation++;
+        fs.writeSuperBlock(); // before any other block, readers see it odd from now on
+    }
+}
+
+template<size_t BLOCK_SIZE>
+BlockFileSystem<BLOCK_SIZE>::Change::~Change() {
+    if (--fs.changes == 0 && fs.superBlock.generation % 2 == 1) {
+        fs.superBlock.generation++;
+        try {
+            fs.writeSuperBlock();
+        } catch (runtime_error &e) { // left odd as if the writer crashed, the next writable mount fixes it
+            cerr << "Unable to finish a change of BFS: " << e.what() << endl;
+        }
+    }
+}
+
+template<size_t BLOCK_SIZE>
+uint32_t BlockFileSystem<BLOCK_SIZE>::readGeneration() {
+    auto buffer = pool.acquire();
+    disk.read(0, buffer.get());
+    return buffer.as<Block>().super.generation;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::loadView() {
+    auto buffer = pool.acquire();
+    auto &block = buffer.as<Block>();
+    disk.read(0, buffer.get());
     superBlock = block.super;
-    disk.read(1, block.data);
+    if (mountedSnapshot.empty()) { // only InodeBitMap is checked by reads
+        disk.read(1, buffer.get());
+        inodeMap = block.inodeMap;
+        return;
+    }
+    auto snapshots = readSnapshots();
+    auto found = find_if(snapshots.begin(), snapshots.end(), [this](const Snapshot &s) {
+        return s.name == mountedSnapshot;
+    });
+    if (found == snapshots.end()) {
+        throw runtime_error("Snapshot " + mountedSnapshot + " does not exist");
+    }
+    disk.read(found->inodeMap, buffer.get());
     inodeMap = block.inodeMap;
-    disk.read(2, block.data);
+    disk.read(found->blockMap, buffer.get());
     blockMap = block.blockMap;
+    inodeRemap = readRemap(*found); // grows as live BFS copies inode blocks
 }
 
-void FileSystem::setUid(uint16_t uid) {
+template<size_t BLOCK_SIZE>
+template<typename Read>
+auto BlockFileSystem<BLOCK_SIZE>::readConsistently(Read read) -> decltype(read()) {
+    if (!readOnly) { // every writer is this process
+        return read();
+    }
+    for (size_t attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+        auto generation = readGeneration();
+        if (generation % 2 == 0) {
+            try {
+                if (generation != viewGeneration) {
+                    loadView();
+                    viewGeneration = generation;
+                }
+                auto result = read();
+                if (readGeneration() == generation) {
+                    return result;
+                }
+            } catch (runtime_error &) { // blocks of different generations may make no sense together
+                if (readGeneration() == generation) {
+                    throw;
+                }
+            }
+        }
+        this_thread::sleep_for(chrono::microseconds(min(attempt, (size_t) 1000))); // a change takes one call
+    }
+    throw runtime_error("BFS keeps changing, the read-only mount gave up");
+}
+
+template<size_t BLOCK_SIZE>
+vector<FileSystemBase::Snapshot> BlockFileSystem<BLOCK_SIZE>::readSnapshots() {
+    if (superBlock.snapshotBlock == 0) {
+        return {};
+    }
+    auto buffer = pool.acquire();
+    disk.read(superBlock.snapshotBlock, buffer.get());
+    auto &table = buffer.as<Block>().snapshots;
+    vector<Snapshot> snapshots;
+    copy_if(begin(table), end(table), back_inserter(snapshots), [](const Snapshot &s) { return s.name[0] != '\0'; });
+    return snapshots;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeSnapshots(const vector<Snapshot> &snapshots) {
+    auto buffer = pool.acquire();
+    auto data = buffer.get();
+    fill(data.begin(), data.end(), 0);
+    copy(snapshots.begin(), snapshots.end(), buffer.as<Block>().snapshots);
+    disk.write(superBlock.snapshotBlock, data);
+}
+
+template<size_t BLOCK_SIZE>
+vector<uint32_t> BlockFileSystem<BLOCK_SIZE>::readRemap(const Snapshot &snapshot) {
+    vector<uint32_t> remap;
+    auto buffer = pool.acquire();
+    for (auto location: snapshot.remap) {
+        if (location != 0) {
+            disk.read(location, buffer.get());
+            auto &pointers = buffer.as<Block>().pointers;
+            remap.insert(remap.end(), begin(pointers), end(pointers));
+        }
+    }
+    return remap;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::loadSnapshots() {
+    heldMap.reset();
+    sharedInodeBlocks.reset();
+    auto buffer = pool.acquire();
+    for (const auto &snapshot: readSnapshots()) {
+        disk.read(snapshot.blockMap, buffer.get());
+        heldMap |= ~buffer.as<Block>().blockMap;
+        heldMap.set(getBlockMapIndex(snapshot.inodeMap));
+        heldMap.set(getBlockMapIndex(snapshot.blockMap));
+        for (auto location: snapshot.remap) {
+            if (location != 0) {
+                heldMap.set(getBlockMapIndex(location));
+            }
+        }
+        auto remap = readRemap(snapshot);
+        for (size_t i = 0; i < superBlock.inodeBlocks; i++) {
+            remap[i] == 0 ? sharedInodeBlocks.set(i) : heldMap.set(getBlockMapIndex(remap[i]));
+        }
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::copyInodeBlock(size_t number) {
+    auto relative = number - superBlock.inodeOffset;
+    if (!inodeRemap.empty() || !sharedInodeBlocks[relative]) {
+        return;
+    }
+    auto buffer = pool.acquire();
+    disk.read(number, buffer.get());
+    auto copyIndex = allocateBlocks(1)[0];
+    auto copyLocation = getBlockLocation(copyIndex);
+    disk.write(copyLocation, buffer.get());
+    heldMap.set(copyIndex);
+    deadMap.set(copyIndex); // one copy serves all snapshots that have none
+    deadMapChanged = true;
+    for (const auto &snapshot: readSnapshots()) {
+        auto remapBlock = snapshot.remap[relative / POINTER_COUNT_PER_BLOCK];
+        disk.read(remapBlock, buffer.get());
+        auto &pointer = buffer.as<Block>().pointers[relative % POINTER_COUNT_PER_BLOCK];
+        if (pointer == 0) {
+            pointer = copyLocation;
+            disk.write(remapBlock, buffer.get());
+        }
+    }
+    sharedInodeBlocks.reset(relative);
+    writeBlockMap();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::redirectBlock(uint32_t &location) {
+    if (!heldMap[getBlockMapIndex(location)]) {
+        return;
+    }
+    auto index = allocateBlocks(1)[0];
+    releaseBlock(getBlockMapIndex(location)); // becomes dead
+    location = getBlockLocation(index);
+    writeBlockMap();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::createSnapshot(const string &name) {
+    Change change(*this);
+    checkWritable();
+    if (name.empty() || name.length() >= sizeof(Snapshot::name)) {
+        throw runtime_error("Illegal snapshot name");
+    }
+    auto remapBlocks = (superBlock.inodeBlocks * sizeof(uint32_t) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (remapBlocks > size(Snapshot{}.remap)) {
+        throw runtime_error("Too many inode blocks for snapshots");
+    }
+    sync(); // data buffered so far belongs to the snapshot
+    auto buffer = pool.acquire();
+    auto &block = buffer.as<Block>();
+    auto data = buffer.get();
+    if (superBlock.snapshotBlock == 0) { // the snapshot table and DeadBitMap belong to live BFS
+        auto locations = allocateBlocks(2);
+        superBlock.snapshotBlock = getBlockLocation(locations[0]);
+        superBlock.deadBlock = getBlockLocation(locations[1]);
+        writeSnapshots({});
+        deadMap.reset();
+        deadMapChanged = true;
+    }
+    auto snapshots = readSnapshots();
+    for (const auto &snapshot: snapshots) {
+        if (snapshot.name == name) {
+            throw runtime_error("Snapshot " + name + " already exists");
+        }
+    }
+    if (snapshots.size() >= SNAPSHOT_COUNT_PER_BLOCK) {
+        throw runtime_error("Too many snapshots");
+    }
+
+    auto locations = allocateBlocks(2 + remapBlocks);
+    for (auto i: locations) { // not referred to by live BFS
+        heldMap.set(i);
+        deadMap.set(i);
+    }
+    Snapshot snapshot{};
+    copy(name.begin(), name.end(), snapshot.name);
+    snapshot.creationTime = getTime();
+    snapshot.inodeMap = getBlockLocation(locations[0]);
+    snapshot.blockMap = getBlockLocation(locations[1]);
+    block.inodeMap = inodeMap;
+    disk.write(snapshot.inodeMap, data);
+    block.blockMap = blockMap | deadMap; // blocks live BFS refers to
+    block.blockMap.set(getBlockMapIndex(superBlock.snapshotBlock));
+    block.blockMap.set(getBlockMapIndex(superBlock.deadBlock));
+    disk.write(snapshot.blockMap, data);
+    heldMap |= ~block.blockMap;
+    fill(data.begin(), data.end(), 0); // every inode block is shared with live BFS for now
+    for (size_t i = 0; i < remapBlocks; i++) {
+        snapshot.remap[i] = getBlockLocation(locations[2 + i]);
+        disk.write(snapshot.remap[i], data);
+    }
+    for (size_t i = 0; i < superBlock.inodeBlocks; i++) {
+        sharedInodeBlocks.set(i);
+    }
+    snapshots.push_back(snapshot);
+    writeSnapshots(snapshots);
+    deadMapChanged = true;
+    writeBlockMap();
+    writeSuperBlock();
+}
+
+template<size_t BLOCK_SIZE>
+vector<FileSystemBase::SnapshotInfo> BlockFileSystem<BLOCK_SIZE>::listSnapshots() {
+    if (!disk.mounted()) {
+        throw runtime_error("BFS is not mounted");
+    }
+    return readConsistently([this] {
+        vector<SnapshotInfo> infos;
+        auto buffer = pool.acquire();
+        for (const auto &snapshot: readSnapshots()) {
+            disk.read(snapshot.blockMap, buffer.get());
+            auto remap = readRemap(snapshot);
+            infos.push_back({
+                snapshot.name,
+                snapshot.creationTime,
+                superBlock.dataBlocks - countBits(buffer.get().data(), 0, superBlock.dataBlocks),
+                (uint32_t) count_if(remap.begin(), remap.end(), [](uint32_t location) { return location != 0; }),
+            });
+        }
+        return infos;
+    });
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::deleteSnapshot(const string &name) {
+    Change change(*this);
+    checkWritable();
+    if (!disk.mounted()) {
+        throw runtime_error("BFS is not mounted");
+    }
+    auto snapshots = readSnapshots();
+    auto found = find_if(snapshots.begin(), snapshots.end(), [&name](const Snapshot &s) { return s.name == name; });
+    if (found == snapshots.end()) {
+        throw runtime_error("Snapshot " + name + " does not exist");
+    }
+    snapshots.erase(found);
+    writeSnapshots(snapshots);
+    loadSnapshots(); // what the others still refer to
+    for (auto i = deadMap._Find_first(); i < deadMap.size(); i = deadMap._Find_next(i)) {
+        if (!heldMap[i]) {
+            deadMap.reset(i);
+            markBlock(i, true);
+        }
+    }
+    deadMapChanged = true;
+    if (snapshots.empty()) { // give the snapshot table and DeadBitMap back
+        markBlock(getBlockMapIndex(superBlock.snapshotBlock), true);
+        markBlock(getBlockMapIndex(superBlock.deadBlock), true);
+        superBlock.snapshotBlock = 0;
+        superBlock.deadBlock = 0;
+    }
+    writeBlockMap();
+    writeSuperBlock();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setUid(uint16_t uid) {
     currentUid = uid;
 }
 
-uint32_t FileSystem::getTime() {
+template<size_t BLOCK_SIZE>
+uint32_t BlockFileSystem<BLOCK_SIZE>::getTime() {
     using namespace chrono;
     return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
 }
 
-pair<size_t, size_t> FileSystem::getInodeLocation(size_t index) {
-    auto number = index / INODE_COUNT_PER_BLOCK + superBlock.inodeOffset;
+template<size_t BLOCK_SIZE>
+pair<size_t, size_t> BlockFileSystem<BLOCK_SIZE>::getInodeLocation(size_t index) {
+    auto number = index / INODE_COUNT_PER_BLOCK;
     auto offset = index % INODE_COUNT_PER_BLOCK;
-    return {number, offset};
+    if (!inodeRemap.empty() && inodeRemap[number] != 0) { // changed after the mounted snapshot was taken
+        return {inodeRemap[number], offset};
+    }
+    return {number + superBlock.inodeOffset, offset};
 }
 
-size_t FileSystem::getBlockLocation(size_t index) {
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::getBlockLocation(size_t index) {
     return index + superBlock.blockOffset;
 }
 
-size_t FileSystem::getBlockMapIndex(size_t location) {
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::getBlockMapIndex(size_t location) {
     return location - superBlock.blockOffset;
 }
 
-void FileSystem::checkInode(size_t index, bool shouldBeUsed) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::checkInode(size_t index, bool shouldBeUsed) {
     if (!disk.mounted()) {
         throw runtime_error("BFS is not mounted");
     }
@@ -108,7 +818,8 @@ void FileSystem::checkInode(size_t index, bool shouldBeUsed) {
     }
 }
 
-void FileSystem::checkBlock(size_t index) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::checkBlock(size_t index) {
     if (!disk.mounted()) {
         throw runtime_error("BFS is not mounted");
     }
@@ -117,18 +828,19 @@ void FileSystem::checkBlock(size_t index) {
     }
 }
 
-void FileSystem::initDirectory(size_t index, size_t parent) {
-    Block entryBlock{};
-    entryBlock.directoryEntries[0].inode = index;
-    entryBlock.directoryEntries[0].filename[0] = '.';
-    entryBlock.directoryEntries[1].inode = parent;
-    entryBlock.directoryEntries[1].filename[0] = '.';
-    entryBlock.directoryEntries[1].filename[1] = '.';
-    auto data = string(entryBlock.data, 2 * DIRECTORY_ENTRY_SIZE);
-    writeInode(index, data);
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::initDirectory(size_t index, size_t parent) {
+    DirectoryEntry entries[2]{};
+    entries[0].inode = index;
+    entries[0].filename[0] = '.';
+    entries[1].inode = parent;
+    entries[1].filename[0] = '.';
+    entries[1].filename[1] = '.';
+    writeInode(index, string(reinterpret_cast<const char *>(entries), sizeof(entries)));
 }
 
-size_t FileSystem::createInode(Permissions mode) {
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::createInode(Permissions mode) {
     auto index = inodeMap._Find_first(); // first free inode
     checkInode(index);
     setInodeMap(index, false); // mark as used
@@ -144,205 +856,531 @@ size_t FileSystem::createInode(Permissions mode) {
     return index;
 }
 
-void FileSystem::removeInode(size_t index) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::removeInode(size_t index, const Inode &inode) {
     checkInode(index, true);
-    Block emptyBlock{};
-    auto inode = getInode(index);
-    auto directFilled = true;
-    for (auto i = begin(inode.direct); i != end(inode.direct); i++) { // free direct blocks
-        auto location = *i;
-        auto mapIndex = getBlockMapIndex(location);
-        if (location == 0 || blockMap[mapIndex]) {
-            directFilled = false;
-            break;
-        }
-        setBlockMap(mapIndex, true);
-        disk.write(location, emptyBlock.data);
+    if (dirtyData.count(index)) { // data never reached the disk
+        dirtyBytes -= dirtyData[index].data.length();
+        dirtyBlocks -= getBlockCount(dirtyData[index].data.length());
+        dirtyData.erase(index);
     }
-    if (directFilled && inode.indirect != 0) { // free indirect blocks
-        Block pointerBlock{};
-        disk.read(inode.indirect, pointerBlock.data);
-        for (auto i = begin(pointerBlock.pointers); i != end(pointerBlock.pointers); i++) {
-            auto location = *i;
-            auto mapIndex = getBlockMapIndex(location);
-            if (location == 0 || blockMap[mapIndex]) {
-                break;
-            }
-            setBlockMap(mapIndex, true);
-            disk.write(location, emptyBlock.data);
-        }
-        setBlockMap(getBlockMapIndex(inode.indirect), true);
-        disk.write(inode.indirect, emptyBlock.data); // free indirect blocks pointer
+    sparseDirectories.erase(index);
+    // only bitmaps are touched, callers write them back once; stale inodes are overwritten by createInode
+    for (auto location: collectBlocks(inode)) { // free data blocks and indirect blocks pointer
+        releaseBlock(getBlockMapIndex(location));
+    }
+    markInode(index, true);
+}
+
+template<size_t BLOCK_SIZE>
+BlockFileSystem<BLOCK_SIZE>::InodeIterator::InodeIterator(BlockFileSystem &fs)
+    : fs(fs), chunk(min((size_t) STREAM_BLOCKS, getBlockCount(fs.getInodeCount() * INODE_SIZE)) * BLOCK_SIZE) {}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::InodeIterator::load(size_t number) {
+    auto count = fs.getInodeCount();
+    auto last = min((number + chunk.size() / BLOCK_SIZE) * INODE_COUNT_PER_BLOCK, count);
+    while (fs.inodeMap[last - 1]) { // blocks after the last used inode are not read, the one of number has one
+        last--;
+    }
+    auto end = (last + INODE_COUNT_PER_BLOCK - 1) / INODE_COUNT_PER_BLOCK;
+    for (size_t i = number, j; i < end; i = j) { // one read for every run, copied blocks of a snapshot break it
+        auto location = fs.getInodeLocation(i * INODE_COUNT_PER_BLOCK).first;
+        for (j = i + 1; j < end && fs.getInodeLocation(j * INODE_COUNT_PER_BLOCK).first == location + (j - i); j++);
+        fs.disk.read(location, span<char>(chunk).subspan((i - number) * BLOCK_SIZE, (j - i) * BLOCK_SIZE));
+    }
+    first = number;
+    loaded = end - number;
+}
+
+template<size_t BLOCK_SIZE>
+bool BlockFileSystem<BLOCK_SIZE>::InodeIterator::next() {
+    auto count = fs.getInodeCount();
+    while (++index < count && fs.inodeMap[index]); // starts from SIZE_MAX, which wraps to 0
+    if (index >= count) {
+        index = count;
+        return false;
     }
-    Inode emptyInode{};
-    setInode(index, emptyInode); // free inode
-    setInodeMap(index, true); // update InodeBitMap
+    auto number = index / INODE_COUNT_PER_BLOCK;
+    if (number < first || number >= first + loaded) {
+        load(number);
+    }
+    return true;
+}
+
+template<size_t BLOCK_SIZE>
+const FileSystemBase::Inode &BlockFileSystem<BLOCK_SIZE>::InodeIterator::get() const {
+    auto block = reinterpret_cast<const Block *>(chunk.data() + (index / INODE_COUNT_PER_BLOCK - first) * BLOCK_SIZE);
+    return block->inodes[index % INODE_COUNT_PER_BLOCK];
 }
 
-FileSystem::Inode FileSystem::getInode(size_t index) {
+template<size_t BLOCK_SIZE>
+FileSystemBase::Inode BlockFileSystem<BLOCK_SIZE>::getInode(size_t index) {
     checkInode(index, true);
-    Block inodeBlock{};
+    auto buffer = pool.acquire();
     auto[inodeBlockNumber, inodeBlockOffset] = getInodeLocation(index);
-    disk.read(inodeBlockNumber, inodeBlock.data);
-    return inodeBlock.inodes[inodeBlockOffset];
+    disk.read(inodeBlockNumber, buffer.get());
+    return buffer.as<Block>().inodes[inodeBlockOffset];
+}
+
+template<size_t BLOCK_SIZE>
+vector<FileSystemBase::Inode> BlockFileSystem<BLOCK_SIZE>::getInodes(const vector<size_t> &indices) {
+    vector<size_t> order(indices.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&indices](size_t a, size_t b) { return indices[a] < indices[b]; });
+    vector<Inode> inodes(indices.size());
+    auto buffer = pool.acquire();
+    auto &inodeBlock = buffer.as<Block>();
+    size_t loadedBlockNumber = 0; // inode blocks never start at 0
+    for (auto i: order) { // visit inode blocks in ascending order, reading each of them once
+        checkInode(indices[i], true);
+        auto[inodeBlockNumber, inodeBlockOffset] = getInodeLocation(indices[i]);
+        if (inodeBlockNumber != loadedBlockNumber) {
+            disk.read(inodeBlockNumber, buffer.get());
+            loadedBlockNumber = inodeBlockNumber;
+        }
+        inodes[i] = inodeBlock.inodes[inodeBlockOffset];
+    }
+    return inodes;
 }
 
-void FileSystem::setInode(size_t index, FileSystem::Inode inode) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setInode(size_t index, FileSystemBase::Inode inode) {
     checkInode(index, true);
-    Block inodeBlock{};
+    auto buffer = pool.acquire();
     auto[inodeBlockNumber, inodeBlockOffset] = getInodeLocation(index);
-    disk.read(inodeBlockNumber, inodeBlock.data);
-    inodeBlock.inodes[inodeBlockOffset] = inode;
-    disk.write(inodeBlockNumber, inodeBlock.data);
+    copyInodeBlock(inodeBlockNumber);
+    disk.read(inodeBlockNumber, buffer.get());
+    buffer.as<Block>().inodes[inodeBlockOffset] = inode;
+    disk.write(inodeBlockNumber, buffer.get());
 }
 
-string FileSystem::readInode(size_t index) {
+template<size_t BLOCK_SIZE>
+string BlockFileSystem<BLOCK_SIZE>::readInode(size_t index) {
     checkInode(index, true);
     auto inode = getInode(index);
     if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_R : Permissions::OTH_R)) == Permissions::NONE) {
         throw runtime_error("Permission denied");
     }
-    Block dataBlock{};
-    string res;
-    auto directFilled = true;
-    for (auto i = begin(inode.direct); i != end(inode.direct); i++) { // read direct blocks
-        auto location = *i;
-        auto mapIndex = getBlockMapIndex(location);
-        if (location == 0 || blockMap[mapIndex]) {
-            directFilled = false;
-            break;
-        }
-        disk.read(location, dataBlock.data);
-        res.append(dataBlock.data, Disk::BLOCK_SIZE);
+    if (dirtyData.count(index)) {
+        return dirtyData[index].data;
     }
-    if (directFilled && inode.indirect != 0) {
-        Block pointerBlock{};
-        disk.read(inode.indirect, pointerBlock.data);
-        for (auto i = begin(pointerBlock.pointers); i != end(pointerBlock.pointers); i++) { // read indirect blocks
-            auto location = *i;
-            auto mapIndex = getBlockMapIndex(location);
-            if (location == 0 || blockMap[mapIndex]) {
-                break;
-            }
-            disk.read(location, dataBlock.data);
-            res.append(dataBlock.data, Disk::BLOCK_SIZE);
+    return readBlocks(inode);
+}
+
+template<size_t BLOCK_SIZE>
+string BlockFileSystem<BLOCK_SIZE>::readBlocks(const Inode &inode) {
+    auto pointers = getPointers(inode, (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    string res(pointers.size() * BLOCK_SIZE, '\0'); // holes are read as zeros without I/O
+    span<char> data(res);
+    for (size_t i = 0, j; i < pointers.size(); i = j) { // one read for every contiguous run, right into the result
+        for (j = i + 1; j < pointers.size() && pointers[i] != 0 && pointers[j] == pointers[j - 1] + 1; j++);
+        if (pointers[i] != 0) {
+            disk.read(pointers[i], data.subspan(i * BLOCK_SIZE, (j - i) * BLOCK_SIZE));
         }
     }
     res.resize(inode.size);
     return res;
 }
 
-void FileSystem::writeInode(size_t index, const string &src) { // no plan to implement offset
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeInode(size_t index, const string &src) { // no plan to implement offset
     checkInode(index, true);
-    if (src.length() >= (DIRECT_BLOCKS_PER_INODE + INDIRECT_BLOCKS_PER_INODE) * Disk::BLOCK_SIZE) {
+    checkWritable();
+    if (src.length() >= (DIRECT_BLOCKS_PER_INODE + INDIRECT_BLOCKS_PER_INODE) * BLOCK_SIZE) {
         throw runtime_error("Source size exceeds capability of BFS");
     }
     auto inode = getInode(index);
     if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_W : Permissions::OTH_W)) == Permissions::NONE) {
         throw runtime_error("Permission denied");
     }
-    auto srcOffset = writeBlocks(src, begin(inode.direct), end(inode.direct), 0); // write direct blocks
+    if ((inode.mode & Permissions::DIR) == Permissions::NONE) { // file data is allocated lazily, the inode with it
+        bufferInode(index, src);
+        return;
+    }
+    inode.modificationTime = getTime(); // update modification time
+    writeDirectory(index, inode, src);
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeDirectory(size_t index, Inode &inode, const string &src) {
+    if (dirtyBlocks > 0) { // blocks reserved for buffered data are not taken, that data is written first if needed
+        auto present = collectBlocks(inode).size();
+        auto needed = getBlockCount(src.length());
+        if (needed > present && dirtyBlocks + needed - present > freeBlockCount()) {
+            commitDirty(); // only files, so index and inode stay as they are
+        }
+    }
+    auto srcOffset = writeBlocks(src, inode.direct, 0); // write direct blocks
     if (srcOffset < src.length()) {
-        Block pointerBlock{};
+        auto buffer = pool.acquire();
+        auto &pointerBlock = buffer.as<Block>();
         if (inode.indirect == 0) {
             auto indirectMapIndex = blockMap._Find_first();
             checkBlock(indirectMapIndex);
             auto indirectLocation = getBlockLocation(indirectMapIndex);
             setBlockMap(indirectMapIndex, false);
             inode.indirect = indirectLocation;
+            fill(begin(pointerBlock.pointers), end(pointerBlock.pointers), 0);
         } else {
-            disk.read(inode.indirect, pointerBlock.data);
+            disk.read(inode.indirect, buffer.get());
+            redirectBlock(inode.indirect);
         }
-        writeBlocks(src, begin(pointerBlock.pointers), end(pointerBlock.pointers), srcOffset); // write indirect blocks
-        disk.write(inode.indirect, pointerBlock.data);
+        writeBlocks(src, pointerBlock.pointers, srcOffset); // write indirect blocks
+        disk.write(inode.indirect, buffer.get());
     }
     inode.size = src.length();
-    inode.modificationTime = getTime(); // update modification time
     setInode(index, inode);
 }
 
-int FileSystem::writeBlocks(const string &src, uint32_t *begin, const uint32_t *end, int offset) {
-    auto BLOCK_SIZE = Disk::BLOCK_SIZE;
-    for (auto i = begin; i != end && offset < src.length(); i++, offset += BLOCK_SIZE) {
-        auto length = min(BLOCK_SIZE, src.length() - offset);
-        Block dataBlock{};
-        if (*i == 0) {
-            auto mapIndex = blockMap._Find_first();
-            checkBlock(mapIndex);
-            *i = getBlockLocation(mapIndex);
-            setBlockMap(mapIndex, false);
-        } else {
-            disk.read(*i, dataBlock.data);
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::truncateBlocks(Inode &inode, size_t count) {
+    for (auto i = count; i < DIRECT_BLOCKS_PER_INODE; i++) {
+        if (inode.direct[i] != 0) {
+            releaseBlock(getBlockMapIndex(inode.direct[i]));
+            inode.direct[i] = 0;
         }
-        auto newData = string(dataBlock.data, BLOCK_SIZE);
-        newData.replace(0, length, src, offset, length);
-        disk.write(*i, newData.data());
     }
-    return offset;
-}
-
-size_t FileSystem::locateFile(const string &path) {
-    auto parts = Utils::split(path, "/");
-    auto currentIndex = path[0] == '/' ? 0 : currentInodeIndex;
-    for (auto &part : parts) {
-        auto data = readInode(currentIndex);
-        auto entries = reinterpret_cast<DirectoryEntry *>(data.data());
-        auto matched = false;
-        for (auto i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
-            if (part == entries[i].filename) {
-                currentIndex = entries[i].inode;
-                matched = true;
-                break;
-            }
-        }
-        if (!matched) {
-            throw runtime_error("Illegal path: " + part + " does not exist");
+    if (inode.indirect == 0) {
+        return;
+    }
+    auto buffer = pool.acquire();
+    auto &pointerBlock = buffer.as<Block>();
+    disk.read(inode.indirect, buffer.get());
+    auto from = count > DIRECT_BLOCKS_PER_INODE ? count - DIRECT_BLOCKS_PER_INODE : 0;
+    for (auto i = from; i < INDIRECT_BLOCKS_PER_INODE; i++) {
+        if (pointerBlock.pointers[i] != 0) {
+            releaseBlock(getBlockMapIndex(pointerBlock.pointers[i]));
+            pointerBlock.pointers[i] = 0;
         }
     }
-    return currentIndex;
+    if (from == 0) { // no indirect blocks are left
+        releaseBlock(getBlockMapIndex(inode.indirect));
+        inode.indirect = 0;
+    } else {
+        redirectBlock(inode.indirect);
+        disk.write(inode.indirect, buffer.get());
+    }
 }
 
-size_t FileSystem::locateParent(const string &path) {
-    auto parentPath = path[path.size() - 1] == '/' ? path.substr(0, path.size() - 1) : path;
-    auto lastSlash = parentPath.find_last_of('/');
-    if (lastSlash == string::npos) {
-        return currentInodeIndex;
-    }
-    parentPath = parentPath.substr(0, lastSlash) + "/";
-    auto index = locateFile(parentPath);
+template<size_t BLOCK_SIZE>
+bool BlockFileSystem<BLOCK_SIZE>::isFreeEntry(const DirectoryEntry &entry) {
+    return entry.filename[0] == '\0'; // filenames are never empty
+}
+
+template<size_t BLOCK_SIZE>
+bool BlockFileSystem<BLOCK_SIZE>::matchEntry(const DirectoryEntry &entry, string_view name) {
+    // a filename fills its field up to a NUL, a free entry starts with one and a name never does
+    return name.length() < sizeof(entry.filename) && memcmp(entry.filename, name.data(), name.length()) == 0
+           && entry.filename[name.length()] == '\0';
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeEntry(size_t index, size_t slot, const DirectoryEntry &entry) {
     auto inode = getInode(index);
-    if ((inode.mode & Permissions::DIR) == Permissions::NONE) {
-        throw runtime_error("Illegal path: " + parentPath + " is not a directory");
+    auto number = slot / ENTRY_COUNT_PER_BLOCK;
+    auto location = getPointers(inode, number + 1)[number];
+    // a block of free slots may be a hole, which is allocated by writing the directory, so is one of a snapshot moved
+    if (location == 0 || heldMap[getBlockMapIndex(location)]) {
+        auto data = readBlocks(inode);
+        memcpy(&data[slot * DIRECTORY_ENTRY_SIZE], &entry, DIRECTORY_ENTRY_SIZE);
+        writeDirectory(index, inode, data);
+        return;
     }
-    return index;
+    auto buffer = pool.acquire();
+    disk.read(location, buffer.get());
+    buffer.as<Block>().directoryEntries[slot % ENTRY_COUNT_PER_BLOCK] = entry;
+    disk.write(location, buffer.get());
 }
 
-void FileSystem::createFile(const string &path) {
-    if (path == "/") {
-        throw runtime_error("Root directory has already been created");
-    }
-    auto isDirectory = path[path.size() - 1] == '/';
-    auto parts = Utils::split(path, "/");
-    auto filename = parts[parts.size() - 1];
-    if (filename.length() <= 0 || filename.length() >= sizeof(DirectoryEntry::filename)) {
-        throw runtime_error("Illegal filename");
-    }
-    auto index = locateParent(path);
-    union {
-        char *data;
-        DirectoryEntry *entries;
-    } temp{};
-    auto data = readInode(index);
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::compactDirectory(size_t index) {
     auto inode = getInode(index);
-    data.resize(inode.size + DIRECTORY_ENTRY_SIZE);
-    temp.data = data.data();
-    for (int i = 0; i < inode.size / DIRECTORY_ENTRY_SIZE; i++) {
-        if (string(temp.entries[i].filename) == filename) {
-            throw runtime_error("Illegal path: " + filename + " already exists");
+    auto data = readBlocks(inode);
+    auto entries = reinterpret_cast<const DirectoryEntry *>(data.data());
+    string compacted;
+    compacted.reserve(data.size());
+    for (size_t i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
+        if (!isFreeEntry(entries[i])) {
+            compacted.append(reinterpret_cast<const char *>(&entries[i]), DIRECTORY_ENTRY_SIZE);
         }
     }
-    auto &newEntry = temp.entries[inode.size / DIRECTORY_ENTRY_SIZE];
-    // std::copy is a more C++ way than str(n)cpy
+    truncateBlocks(inode, (compacted.size() + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    writeDirectory(index, inode, compacted); // entries keep their order, so does modification time
+    writeBlockMap();
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::bufferInode(size_t index, const string &src) {
+    auto previous = dirtyData.count(index) ? dirtyData[index].data.length() : 0;
+    auto reserved = dirtyBlocks - getBlockCount(previous) + getBlockCount(src.length());
+    if (reserved > freeBlockCount()) { // no room to defer, write back everything including this file
+        sync();
+        commitInode(index, src, getTime());
+        return;
+    }
+    dirtyData[index] = {src, getTime()}; // later writes to the same file coalesce here
+    dirtyBytes = dirtyBytes - previous + src.length();
+    dirtyBlocks = reserved;
+    if (dirtyBytes > MAX_DIRTY_BYTES) {
+        sync();
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::commitDirty() {
+    for (const auto &[index, file]: dirtyData) { // allocation happens now that final sizes are known
+        commitInode(index, file.data, file.modificationTime);
+    }
+    dirtyData.clear();
+    dirtyBytes = 0;
+    dirtyBlocks = 0;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::commitInode(size_t index, const string &src, uint32_t modificationTime) {
+    auto inode = getInode(index);
+    auto released = collectBlocks(inode);
+    auto blockCount = (src.length() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    auto fullCount = src.length() / BLOCK_SIZE;
+    auto tail = pool.acquire(); // the last partial block padded with zeros, other blocks are used in place
+    if (fullCount < blockCount) {
+        auto padded = tail.get();
+        fill(copy(src.begin() + fullCount * BLOCK_SIZE, src.end(), padded.begin()), padded.end(), 0);
+    }
+    auto blockAt = [&src, &tail, fullCount](size_t i) {
+        return i < fullCount ? span<const char>(src).subspan(i * BLOCK_SIZE, BLOCK_SIZE) : span<const char>(tail.get());
+    };
+    vector<size_t> filled; // blocks that are not holes
+    for (size_t i = 0; i < blockCount; i++) {
+        if (!isZeroBlock(blockAt(i).data())) {
+            filled.push_back(i);
+        }
+    }
+    vector<size_t> mapIndices(filled.size()); // block map index of every filled block
+    vector<size_t> sources(filled.size()); // the first filled block with the same data, itself if it is new
+    vector<bool> fresh(filled.size(), true); // whether the block takes new space
+    vector<uint32_t> prints(filled.size());
+    iota(sources.begin(), sources.end(), 0);
+    if (!references.empty()) {
+        unordered_map<uint32_t, size_t> seen; // fingerprint -> first new block of this file with it
+        for (size_t i = 0; i < filled.size(); i++) {
+            auto block = blockAt(filled[i]).data();
+            prints[i] = fingerprint(block);
+            auto duplicate = findDuplicate(block, prints[i]);
+            if (duplicate != SIZE_MAX) {
+                shareBlock(duplicate); // taken before old blocks are released, so unchanged ones are kept
+                mapIndices[i] = duplicate;
+                fresh[i] = false;
+                continue;
+            }
+            auto[first, inserted] = seen.emplace(prints[i], i);
+            if (!inserted && memcmp(block, blockAt(filled[first->second]).data(), BLOCK_SIZE) == 0) {
+                sources[i] = first->second;
+                fresh[i] = false;
+            }
+        }
+    }
+    auto freshCount = (size_t) count(fresh.begin(), fresh.end(), true);
+    auto needIndirect = !filled.empty() && filled.back() >= DIRECT_BLOCKS_PER_INODE;
+    if (freshCount + needIndirect > freeBlockCount()) { // the old blocks are still in use until the inode is written
+        for (size_t i = 0; i < filled.size(); i++) {
+            if (!fresh[i] && sources[i] == i) {
+                releaseBlock(mapIndices[i]);
+            }
+        }
+        throw runtime_error("Space for blocks is not enough");
+    }
+    auto locations = allocateBlocks(freshCount + needIndirect);
+    for (size_t i = 0, j = 0; i < filled.size(); i++) {
+        if (fresh[i]) {
+            mapIndices[i] = locations[j++];
+        } else if (sources[i] != i) {
+            mapIndices[i] = mapIndices[sources[i]];
+            shareBlock(mapIndices[i]);
+        }
+    }
+    auto buffer = pool.acquire();
+    auto &pointerBlock = buffer.as<Block>();
+    fill(begin(pointerBlock.pointers), end(pointerBlock.pointers), 0);
+    fill(begin(inode.direct), end(inode.direct), 0);
+    inode.indirect = 0;
+    for (size_t i = 0; i < filled.size(); i++) {
+        auto location = getBlockLocation(mapIndices[i]);
+        if (filled[i] < DIRECT_BLOCKS_PER_INODE) {
+            inode.direct[filled[i]] = location;
+        } else {
+            pointerBlock.pointers[filled[i] - DIRECT_BLOCKS_PER_INODE] = location;
+        }
+    }
+    if (needIndirect) {
+        inode.indirect = getBlockLocation(locations.back());
+        disk.write(inode.indirect, buffer.get());
+    }
+    for (size_t i = 0, j; i < filled.size(); i = j) { // one write for every contiguous run of new blocks
+        for (j = i + 1; j < filled.size() && fresh[i] && fresh[j] && filled[j] < fullCount
+                        && filled[j] == filled[j - 1] + 1 && mapIndices[j] == mapIndices[j - 1] + 1; j++);
+        if (fresh[i]) { // full blocks go straight from the source, the tail from its padded copy
+            auto first = blockAt(filled[i]);
+            disk.write(getBlockLocation(mapIndices[i]), {first.data(), (j - i) * BLOCK_SIZE});
+        }
+    }
+    if (!references.empty()) { // new blocks can be shared once their data is on disk
+        for (size_t i = 0; i < filled.size(); i++) {
+            if (fresh[i]) {
+                references[mapIndices[i]].fingerprint = prints[i];
+                fingerprints.emplace(prints[i], mapIndices[i]);
+                dirtyReferences.insert(mapIndices[i] / REFERENCE_COUNT_PER_BLOCK);
+            }
+        }
+    }
+    inode.size = src.length();
+    inode.modificationTime = modificationTime;
+    setInode(index, inode); // the old data stays whole until the new one is
+    for (auto location: released) { // only now, so that an inode never points to free blocks
+        releaseBlock(getBlockMapIndex(location));
+    }
+    writeBlockMap(); // also persists the references
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::applyDirty(size_t index, InodeBase &inode) {
+    if (auto found = dirtyData.find(index); found != dirtyData.end()) {
+        inode.size = found->second.data.length();
+        inode.modificationTime = found->second.modificationTime;
+    }
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::writeBlocks(span<const char> src, span<uint32_t> pointers, size_t offset) {
+    auto buffer = pool.acquire(); // only for a partial block, full blocks are written from the source
+    for (auto i = pointers.begin(); i != pointers.end() && offset < src.size(); i++, offset += BLOCK_SIZE) {
+        auto block = src.subspan(offset, min(BLOCK_SIZE, src.size() - offset));
+        if (block.size() < BLOCK_SIZE) { // the rest of the block keeps its data
+            auto data = buffer.get();
+            if (*i != 0) {
+                disk.read(*i, data);
+            } else {
+                fill(data.begin(), data.end(), 0);
+            }
+            copy(block.begin(), block.end(), data.begin());
+            block = data;
+        }
+        if (*i == 0) {
+            if (isZeroBlock(block.data())) { // keep it as a hole
+                continue;
+            }
+            auto mapIndex = blockMap._Find_first();
+            checkBlock(mapIndex);
+            *i = getBlockLocation(mapIndex);
+            setBlockMap(mapIndex, false);
+        } else {
+            redirectBlock(*i);
+        }
+        disk.write(*i, block);
+    }
+    return offset;
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::findEntry(size_t directory, string_view name) {
+    auto inode = getInode(directory);
+    if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_R : Permissions::OTH_R)) == Permissions::NONE) {
+        throw runtime_error("Permission denied");
+    }
+    if ((inode.mode & Permissions::DIR) == Permissions::NONE) { // a file has no entries
+        return SIZE_MAX;
+    }
+    auto count = inode.size / DIRECTORY_ENTRY_SIZE;
+    auto buffer = pool.acquire();
+    auto &entryBlock = buffer.as<Block>();
+    optional<BlockPool::Buffer> pointerBuffer; // only for directories beyond the direct blocks
+    if (count > (DIRECT_BLOCKS_PER_INODE + INDIRECT_BLOCKS_PER_INODE) * ENTRY_COUNT_PER_BLOCK) {
+        throw runtime_error("Inode is broken");
+    }
+    for (size_t number = 0; number * ENTRY_COUNT_PER_BLOCK < count; number++) {
+        if (number == DIRECT_BLOCKS_PER_INODE) { // the indirect blocks pointer is read once
+            if (inode.indirect == 0) {
+                break;
+            }
+            pointerBuffer.emplace(pool.acquire());
+            disk.read(inode.indirect, pointerBuffer->get());
+        }
+        auto location = number < DIRECT_BLOCKS_PER_INODE ? inode.direct[number]
+                                                         : pointerBuffer->as<Block>().pointers[number - DIRECT_BLOCKS_PER_INODE];
+        if (location == 0) { // a hole holds free slots only
+            continue;
+        }
+        disk.read(location, buffer.get());
+        auto last = min((size_t) ENTRY_COUNT_PER_BLOCK, count - number * ENTRY_COUNT_PER_BLOCK);
+        for (size_t i = 0; i < last; i++) {
+            if (matchEntry(entryBlock.directoryEntries[i], name)) {
+                return entryBlock.directoryEntries[i].inode;
+            }
+        }
+    }
+    return SIZE_MAX;
+}
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::locateFile(string_view path) {
+    auto currentIndex = !path.empty() && path[0] == '/' ? 0 : currentInodeIndex;
+    for (auto part = Utils::nextPart(path); !part.empty(); part = Utils::nextPart(path)) {
+        currentIndex = findEntry(currentIndex, part);
+        if (currentIndex == SIZE_MAX) {
+            throw runtime_error("Illegal path: " + string(part) + " does not exist");
+        }
+    }
+    return currentIndex;
+}
+
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::locateParent(string_view path) {
+    auto parentPath = path.ends_with('/') ? path.substr(0, path.size() - 1) : path;
+    auto lastSlash = parentPath.find_last_of('/');
+    if (lastSlash == string_view::npos) {
+        return currentInodeIndex;
+    }
+    parentPath = parentPath.substr(0, lastSlash + 1); // keeps the slash, so that "/" stays the root
+    auto index = locateFile(parentPath);
+    auto inode = getInode(index);
+    if ((inode.mode & Permissions::DIR) == Permissions::NONE) {
+        throw runtime_error("Illegal path: " + string(parentPath) + " is not a directory");
+    }
+    return index;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::createFile(const string &path) {
+    Change change(*this);
+    if (path == "/") {
+        throw runtime_error("Root directory has already been created");
+    }
+    auto isDirectory = path[path.size() - 1] == '/';
+    string_view filename = path;
+    filename.remove_suffix(isDirectory);
+    filename.remove_prefix(filename.find_last_of('/') + 1); // npos + 1 is 0
+    if (filename.empty() || filename.length() >= sizeof(DirectoryEntry::filename)) {
+        throw runtime_error("Illegal filename");
+    }
+    checkWritable();
+    auto index = locateParent(path);
+    auto data = readInode(index);
+    auto inode = getInode(index);
+    if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_W : Permissions::OTH_W)) == Permissions::NONE) {
+        throw runtime_error("Permission denied");
+    }
+    auto entries = reinterpret_cast<const DirectoryEntry *>(data.data());
+    size_t count = inode.size / DIRECTORY_ENTRY_SIZE;
+    auto slot = count; // the first free slot, or a new one at the end
+    for (size_t i = 0; i < count; i++) {
+        if (isFreeEntry(entries[i])) {
+            slot = min(slot, i);
+        } else if (matchEntry(entries[i], filename)) {
+            throw runtime_error("Illegal path: " + string(filename) + " already exists");
+        }
+    }
+    DirectoryEntry newEntry{};
+    // std::copy is a more C++ way than str(n)cpy
     copy(filename.begin(), filename.end(), newEntry.filename);
     newEntry.inode = createInode(
         (isDirectory ? Permissions::DIR : Permissions::NONE)
@@ -351,10 +1389,18 @@ void FileSystem::createFile(const string &path) {
     if (isDirectory) {
         initDirectory(newEntry.inode, index);
     }
-    writeInode(index, string(temp.data, inode.size + DIRECTORY_ENTRY_SIZE));
+    if (slot < count) { // only the block holding the slot is written
+        writeEntry(index, slot, newEntry);
+        return;
+    }
+    data.append(reinterpret_cast<const char *>(&newEntry), DIRECTORY_ENTRY_SIZE);
+    writeInode(index, data);
 }
 
-void FileSystem::removeFile(const string &path) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::removeFile(const string &path) {
+    Change change(*this);
+    checkWritable();
     auto index = locateFile(path);
     if (index == 0) {
         throw runtime_error("Root directory cannot be removed");
@@ -364,24 +1410,29 @@ void FileSystem::removeFile(const string &path) {
         throw runtime_error("Permission denied: file/directory can only be removed by owner");
     }
     auto parent = locateParent(path);
-    union {
-        char *data;
-        DirectoryEntry *entries;
-    } temp{};
     auto parentData = readInode(parent);
     auto parentInode = getInode(parent);
-    temp.data = parentData.data();
-    for (int i = 0; i < parentInode.size / DIRECTORY_ENTRY_SIZE; i++) {
-        if (temp.entries[i].inode == index) {
-            copy(&temp.entries[i + 1], &temp.entries[parentInode.size / DIRECTORY_ENTRY_SIZE], &temp.entries[i]);
-            break;
+    if ((parentInode.mode & (parentInode.uid == currentUid ? Permissions::OWN_W : Permissions::OTH_W))
+        == Permissions::NONE) {
+        throw runtime_error("Permission denied");
+    }
+    auto parentEntries = reinterpret_cast<const DirectoryEntry *>(parentData.data());
+    auto count = parentInode.size / DIRECTORY_ENTRY_SIZE;
+    size_t freeCount = 1; // including the one removed
+    for (size_t i = 0; i < count; i++) {
+        if (isFreeEntry(parentEntries[i])) {
+            freeCount++;
+        } else if (parentEntries[i].inode == index) {
+            writeEntry(parent, i, DirectoryEntry{}); // only the block holding the entry is written
         }
     }
-    writeInode(parent, string(temp.data, parentInode.size - DIRECTORY_ENTRY_SIZE)); // update parent entry
+    if (freeCount >= ENTRY_COUNT_PER_BLOCK && freeCount * 2 >= count) { // a block can be given back
+        sparseDirectories.insert(parent);
+    }
 
     stack<size_t> directories;
-    vector<size_t> toRemove;
-    toRemove.push_back(index);
+    vector<pair<size_t, Inode>> toRemove; // inodes are kept from the bulk reads below, not read again one by one
+    toRemove.emplace_back(index, inode);
     if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
         directories.push(index);
     }
@@ -389,30 +1440,42 @@ void FileSystem::removeFile(const string &path) {
         auto data = readInode(directories.top());
         directories.pop();
         auto entries = reinterpret_cast<DirectoryEntry *>(data.data());
+        vector<size_t> children;
         for (auto i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
-            auto entry = entries[i];
-            if (string(entry.filename) == "." || string(entry.filename) == "..") {
-                continue;
+            if (!isFreeEntry(entries[i]) && !matchEntry(entries[i], ".") && !matchEntry(entries[i], "..")) {
+                children.push_back(entries[i].inode);
             }
-            inode = getInode(entry.inode);
-            if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
-                directories.push(entry.inode);
+        }
+        auto inodes = getInodes(children);
+        for (size_t i = 0; i < children.size(); i++) {
+            if ((inodes[i].mode & Permissions::DIR) != Permissions::NONE) {
+                directories.push(children[i]);
             }
-            toRemove.push_back(entry.inode);
+            toRemove.emplace_back(children[i], inodes[i]);
         }
     }
-    for (auto i: toRemove) { // remove all files
-        removeInode(i);
+    for (const auto &[i, removed]: toRemove) { // remove all files
+        removeInode(i, removed);
     }
+    writeBlockMap(); // update BlockBitMap and InodeBitMap once for the whole tree
+    writeInodeMap();
 }
 
-FileSystem::InodeBase FileSystem::statFile(const string &path) {
-    auto inode = getInode(locateFile(path));
+template<size_t BLOCK_SIZE>
+FileSystemBase::InodeBase BlockFileSystem<BLOCK_SIZE>::statFile(const string &path) {
+    auto inode = readConsistently([&] {
+        auto index = locateFile(path);
+        auto inode = getInode(index);
+        applyDirty(index, inode);
+        return inode;
+    });
     // cast from Inode to InodeBase directly could be more concise, though.
     return {inode.mode, inode.uid, inode.size, inode.creationTime, inode.modificationTime};
 }
 
-void FileSystem::copyFile(const string &from, const string &to) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::copyFile(const string &from, const string &to) {
+    Change change(*this);
     if (from[from.size() - 1] == '/' || to[to.size() - 1] == '/') {
         throw runtime_error("Copying directory is not supported");
     }
@@ -420,54 +1483,512 @@ void FileSystem::copyFile(const string &from, const string &to) {
     writeFile(to, readFile(from));
 }
 
-void FileSystem::moveFile(const string &from, const string &to) {
-    if (from[from.size() - 1] == '/' || to[to.size() - 1] == '/') {
-        throw runtime_error("Moving directory is not supported");
+template<size_t BLOCK_SIZE>
+size_t BlockFileSystem<BLOCK_SIZE>::shareBlocks(const Inode &source, Inode &target) {
+    size_t shared = 0;
+    copy(begin(source.direct), end(source.direct), target.direct);
+    for (auto location: source.direct) {
+        if (location != 0) {
+            shareBlock(getBlockMapIndex(location));
+            shared++;
+        }
     }
-    copyFile(from, to);
-    removeFile(from);
+    if (source.indirect != 0) { // data blocks are shared, the indirect blocks pointer is not
+        auto buffer = pool.acquire();
+        auto &pointerBlock = buffer.as<Block>();
+        disk.read(source.indirect, buffer.get());
+        for (auto location: pointerBlock.pointers) {
+            if (location != 0) {
+                shareBlock(getBlockMapIndex(location));
+                shared++;
+            }
+        }
+        target.indirect = getBlockLocation(allocateBlocks(1)[0]);
+        disk.write(target.indirect, buffer.get());
+    }
+    target.size = source.size;
+    return shared;
 }
 
-void FileSystem::changeDirectory(const string &path) {
-    auto index = locateFile(path);
+template<size_t BLOCK_SIZE>
+FileSystemBase::CopyInfo BlockFileSystem<BLOCK_SIZE>::copyTree(const string &from, const string &to) {
+    Change change(*this);
+    checkWritable();
+    auto start = chrono::steady_clock::now();
+    auto sourceRoot = locateFile(from);
+    if ((getInode(sourceRoot).mode & Permissions::DIR) == Permissions::NONE) {
+        throw runtime_error("Illegal path: " + from + " is not a directory");
+    }
+    auto targetPath = to[to.size() - 1] == '/' ? to : to + "/";
+    createFile(targetPath);
+    auto targetRoot = locateFile(targetPath);
+    CopyInfo info{1};
+
+    // build the skeleton first, every target directory is written once with all of its entries
+    vector<pair<size_t, size_t>> files; // source and target inode of every file
+    stack<pair<size_t, size_t>> directories;
+    directories.emplace(sourceRoot, targetRoot);
+    while (!directories.empty()) {
+        auto[source, target] = directories.top();
+        directories.pop();
+        auto data = readInode(source);
+        auto entries = reinterpret_cast<const DirectoryEntry *>(data.data());
+        vector<size_t> children;
+        vector<const DirectoryEntry *> childEntries;
+        for (size_t i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
+            if (!isFreeEntry(entries[i]) && entries[i].inode != targetRoot // the target may be inside the source
+                && !matchEntry(entries[i], ".") && !matchEntry(entries[i], "..")) {
+                children.push_back(entries[i].inode);
+                childEntries.push_back(&entries[i]);
+            }
+        }
+        auto inodes = getInodes(children);
+        auto targetData = readInode(target);
+        for (size_t i = 0; i < children.size(); i++) {
+            auto isDirectory = (inodes[i].mode & Permissions::DIR) != Permissions::NONE;
+            DirectoryEntry entry = *childEntries[i];
+            entry.inode = createInode(
+                (isDirectory ? Permissions::DIR : Permissions::NONE)
+                | Permissions::OWN_RW | Permissions::GRP_R | Permissions::OTH_R
+            );
+            if (isDirectory) {
+                initDirectory(entry.inode, target);
+                directories.emplace(children[i], entry.inode);
+                info.directories++;
+            } else {
+                files.emplace_back(children[i], entry.inode);
+                info.files++;
+                info.bytes += inodes[i].size;
+            }
+            targetData.append(reinterpret_cast<const char *>(&entry), DIRECTORY_ENTRY_SIZE);
+        }
+        writeInode(target, targetData);
+    }
+
+    // then file data, shared block by block if reference counts exist, otherwise read by a pool of workers
+    vector<pair<size_t, Inode>> jobs; // target and source inode of files whose data is copied
+    for (auto[source, target]: files) {
+        auto inode = getInode(source);
+        if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_R : Permissions::OTH_R)) == Permissions::NONE) {
+            throw runtime_error("Permission denied");
+        }
+        if (dirtyData.count(source)) { // not on disk yet
+            writeInode(target, string(dirtyData[source].data));
+        } else if (!references.empty()) {
+            auto targetInode = getInode(target);
+            info.sharedBlocks += shareBlocks(inode, targetInode);
+            setInode(target, targetInode);
+        } else {
+            jobs.emplace_back(target, inode);
+        }
+    }
+    if (!references.empty()) {
+        writeBlockMap(); // save reference counts of shared blocks
+    }
+    for (size_t first = 0, last; first < jobs.size(); first = last) { // a batch is buffered before it is written
+        size_t batchBytes = 0;
+        for (last = first; last < jobs.size() && (last == first || batchBytes < MAX_DIRTY_BYTES); last++) {
+            batchBytes += jobs[last].second.size;
+        }
+        vector<string> data(last - first);
+        atomic<size_t> next = first;
+        auto work = [this, &jobs, &data, &next, first, last]() {
+            for (auto i = next++; i < last; i = next++) {
+                data[i - first] = readBlocks(jobs[i].second); // only disk reads, which are thread safe
+            }
+        };
+        vector<future<void>> workers;
+        for (size_t i = 1; i < min(COPY_WORKERS, last - first); i++) {
+            workers.push_back(async(launch::async, work));
+        }
+        work(); // the calling thread works as well
+        for (auto &worker: workers) {
+            worker.get(); // rethrows errors of workers
+        }
+        for (auto i = first; i < last; i++) {
+            writeInode(jobs[i].first, data[i - first]);
+        }
+    }
+    sync();
+    info.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return info;
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::exportBlocks(const Inode &inode, ostream &archive, span<char> chunk) {
+    auto count = (inode.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    auto pointers = getPointers(inode, count);
+    for (size_t first = 0; first < count; first += STREAM_BLOCKS) {
+        auto last = min(first + STREAM_BLOCKS, count);
+        for (size_t i = first, j; i < last; i = j) { // one read for every contiguous run within the chunk
+            for (j = i + 1; j < last && pointers[i] != 0 && pointers[j] == pointers[j - 1] + 1; j++);
+            auto run = chunk.subspan((i - first) * BLOCK_SIZE, (j - i) * BLOCK_SIZE);
+            if (pointers[i] != 0) {
+                disk.read(pointers[i], run);
+            } else {
+                fill(run.begin(), run.end(), 0);
+            }
+        }
+        archive.write(chunk.data(), (streamsize) min((last - first) * BLOCK_SIZE, inode.size - first * BLOCK_SIZE));
+    }
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::importBlocks(size_t index, istream &archive, uint64_t size, span<char> chunk) {
+    if (size >= (DIRECT_BLOCKS_PER_INODE + INDIRECT_BLOCKS_PER_INODE) * BLOCK_SIZE) {
+        throw runtime_error("Source size exceeds capability of BFS");
+    }
+    auto inode = getInode(index); // a new file, there are no blocks to release
+    auto blockCount = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    vector<uint32_t> pointers(blockCount); // 0 for holes
+    try { // the inode is written last, so whatever a truncated archive or a full disk leaves taken is released here
+        for (size_t first = 0; first < blockCount; first += STREAM_BLOCKS) {
+            auto count = min((size_t) STREAM_BLOCKS, blockCount - first);
+            auto bytes = min(count * BLOCK_SIZE, size - first * BLOCK_SIZE);
+            if (!archive.read(chunk.data(), (streamsize) bytes)) {
+                throw runtime_error("Unexpected end of tar archive");
+            }
+            fill(chunk.begin() + bytes, chunk.begin() + count * BLOCK_SIZE, 0); // the last block is padded with zeros
+            vector<size_t> fresh; // blocks of the chunk that take new space
+            vector<uint32_t> prints(count);
+            for (size_t i = 0; i < count; i++) {
+                auto block = chunk.data() + i * BLOCK_SIZE;
+                if (isZeroBlock(block)) { // keep it as a hole
+                    continue;
+                }
+                if (!references.empty()) { // duplicates within one chunk are not found, those in earlier chunks are
+                    prints[i] = fingerprint(block);
+                    auto duplicate = findDuplicate(block, prints[i]);
+                    if (duplicate != SIZE_MAX) {
+                        shareBlock(duplicate);
+                        pointers[first + i] = getBlockLocation(duplicate);
+                        continue;
+                    }
+                }
+                fresh.push_back(i);
+            }
+            auto locations = allocateBlocks(fresh.size());
+            for (size_t i = 0; i < fresh.size(); i++) { // taken from now on, released below if the import fails
+                pointers[first + fresh[i]] = getBlockLocation(locations[i]);
+            }
+            for (size_t i = 0, j; i < fresh.size(); i = j) { // one write for every contiguous run
+                for (j = i + 1; j < fresh.size() && fresh[j] == fresh[j - 1] + 1
+                                && locations[j] == locations[j - 1] + 1; j++);
+                disk.write(getBlockLocation(locations[i]), chunk.subspan(fresh[i] * BLOCK_SIZE, (j - i) * BLOCK_SIZE));
+            }
+            for (size_t i = 0; i < fresh.size() && !references.empty(); i++) { // shared once their data is on disk
+                references[locations[i]].fingerprint = prints[fresh[i]];
+                fingerprints.emplace(prints[fresh[i]], locations[i]);
+                dirtyReferences.insert(locations[i] / REFERENCE_COUNT_PER_BLOCK);
+            }
+        }
+        copy_n(pointers.begin(), min(blockCount, (size_t) DIRECT_BLOCKS_PER_INODE), inode.direct);
+        if (blockCount > DIRECT_BLOCKS_PER_INODE) {
+            auto buffer = pool.acquire();
+            auto &pointerBlock = buffer.as<Block>();
+            fill(begin(pointerBlock.pointers), end(pointerBlock.pointers), 0);
+            copy(pointers.begin() + DIRECT_BLOCKS_PER_INODE, pointers.end(), pointerBlock.pointers);
+            inode.indirect = getBlockLocation(allocateBlocks(1)[0]);
+            disk.write(inode.indirect, buffer.get());
+        }
+    } catch (...) {
+        for (auto pointer: pointers) {
+            if (pointer != 0) {
+                releaseBlock(getBlockMapIndex(pointer)); // new blocks are freed, shared ones lose a reference
+            }
+        }
+        if (inode.indirect != 0) {
+            releaseBlock(getBlockMapIndex(inode.indirect));
+        }
+        writeBlockMap();
+        throw;
+    }
+    if (!references.empty()) {
+        writeReferences();
+    }
+    inode.size = size;
+    inode.modificationTime = getTime();
+    setInode(index, inode);
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::setAttributes(size_t index, const Tar::Entry &entry) {
     auto inode = getInode(index);
-    if ((inode.mode & Permissions::DIR) == Permissions::NONE) {
-        throw runtime_error("Illegal path: " + path + " is not a directory");
+    inode.mode = (inode.mode & Permissions::DIR) | static_cast<Permissions>(entry.mode);
+    inode.uid = currentUid == 0 ? entry.uid : currentUid; // only root may give files away
+    inode.modificationTime = entry.modificationTime;
+    setInode(index, inode);
+}
+
+template<size_t BLOCK_SIZE>
+FileSystemBase::TarInfo BlockFileSystem<BLOCK_SIZE>::exportTar(const string &from, ostream &archive) {
+    auto start = chrono::steady_clock::now();
+    sync(); // every file is on disk, a snapshot has nothing buffered
+    // written data cannot be taken back, so a read-only mount checks once at the end instead of retrying
+    auto root = readConsistently([&] {
+        auto index = locateFile(from);
+        if ((getInode(index).mode & Permissions::DIR) == Permissions::NONE) {
+            throw runtime_error("Illegal path: " + from + " is not a directory");
+        }
+        return index;
+    });
+    TarInfo info{};
+
+    // directories go first in the order they are walked, so every one comes before its content
+    vector<pair<size_t, string>> files; // inode and path in the archive of every file
+    stack<pair<size_t, string>> directories;
+    directories.emplace(root, "");
+    while (!directories.empty()) {
+        auto[index, path] = directories.top();
+        directories.pop();
+        auto data = readInode(index);
+        auto entries = reinterpret_cast<const DirectoryEntry *>(data.data());
+        vector<size_t> children;
+        vector<string> names;
+        for (size_t i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
+            if (!isFreeEntry(entries[i]) && !matchEntry(entries[i], ".") && !matchEntry(entries[i], "..")) {
+                children.push_back(entries[i].inode);
+                names.push_back(path + entries[i].filename);
+            }
+        }
+        auto inodes = getInodes(children);
+        for (size_t i = 0; i < children.size(); i++) {
+            if ((inodes[i].mode & Permissions::DIR) == Permissions::NONE) {
+                files.emplace_back(children[i], names[i]);
+                continue;
+            }
+            Tar::writeHeader(archive, {
+                names[i] + "/", '5', (uint16_t) (inodes[i].mode & Permissions::ALL), inodes[i].uid, 0,
+                inodes[i].modificationTime
+            });
+            directories.emplace(children[i], names[i] + "/");
+            info.directories++;
+        }
+    }
+
+    // then files in inode order, so every inode block is read once and data mostly follows the same order
+    sort(files.begin(), files.end());
+    vector<size_t> indices(files.size());
+    transform(files.begin(), files.end(), indices.begin(), [](const pair<size_t, string> &file) { return file.first; });
+    auto inodes = getInodes(indices);
+    vector<char> chunk(STREAM_BLOCKS * BLOCK_SIZE); // the only data buffer, whatever the size of files
+    for (size_t i = 0; i < files.size(); i++) {
+        auto &inode = inodes[i];
+        if ((inode.mode & (inode.uid == currentUid ? Permissions::OWN_R : Permissions::OTH_R)) == Permissions::NONE) {
+            throw runtime_error("Permission denied");
+        }
+        Tar::writeHeader(archive, {
+            files[i].second, '0', (uint16_t) (inode.mode & Permissions::ALL), inode.uid, inode.size,
+            inode.modificationTime
+        });
+        exportBlocks(inode, archive, chunk);
+        Tar::writePadding(archive, inode.size);
+        info.files++;
+        info.bytes += inode.size;
+    }
+    Tar::writeEnd(archive);
+    if (!archive) {
+        throw runtime_error("Unable to write the tar archive");
     }
-    currentInodeIndex = index;
+    if (readOnly && readGeneration() != viewGeneration) {
+        throw runtime_error("BFS was changed during the export, the archive is not consistent");
+    }
+    info.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return info;
 }
 
-vector<pair<string, FileSystem::InodeBase>> FileSystem::listDirectory(const string &path) {
-    vector<pair<string, FileSystem::InodeBase>> stats;
-    string data;
-    if (path.empty()) {
-        data = readInode(currentInodeIndex);
-    } else {
+template<size_t BLOCK_SIZE>
+FileSystemBase::TarInfo BlockFileSystem<BLOCK_SIZE>::importTar(istream &archive, const string &to) {
+    Change change(*this);
+    checkWritable();
+    auto start = chrono::steady_clock::now();
+    if ((getInode(locateFile(to)).mode & Permissions::DIR) == Permissions::NONE) {
+        throw runtime_error("Illegal path: " + to + " is not a directory");
+    }
+    auto root = to[to.size() - 1] == '/' ? to : to + "/";
+    TarInfo info{};
+    vector<pair<size_t, Tar::Entry>> directories; // their attributes are set at the end, read-only ones can be filled
+    vector<char> chunk(STREAM_BLOCKS * BLOCK_SIZE);
+    Tar::Entry entry;
+    while (Tar::readHeader(archive, entry)) {
+        auto path = entry.path;
+        while (path.starts_with("./") || path.starts_with("/")) {
+            path.erase(0, path[0] == '/' ? 1 : 2);
+        }
+        if ((entry.type != '0' && entry.type != '5') || path.empty()) { // links, devices and the root itself
+            Tar::skip(archive, entry.size);
+            info.skipped += !path.empty();
+            continue;
+        }
+        auto parts = Utils::split(path, "/");
+        if (find(parts.begin(), parts.end(), "..") != parts.end()) {
+            throw runtime_error("Illegal path in tar archive: " + entry.path);
+        }
+        createFile(root + path);
+        auto index = locateFile(root + path);
+        if (entry.type == '0') {
+            importBlocks(index, archive, entry.size, chunk);
+            Tar::skipPadding(archive, entry.size);
+            info.files++;
+            info.bytes += entry.size;
+        } else {
+            info.directories++;
+        }
+        if (entry.type == '5') {
+            directories.emplace_back(index, entry);
+        } else {
+            setAttributes(index, entry);
+        }
+    }
+    for (const auto &[index, attributes]: directories) {
+        setAttributes(index, attributes);
+    }
+    writeBlockMap();
+    info.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return info;
+}
+
+template<size_t BLOCK_SIZE>
+vector<FileSystemBase::UsageInfo> BlockFileSystem<BLOCK_SIZE>::diskUsage(const string &path) {
+    sync(); // every file is on disk with its final size and blocks
+    return readConsistently([&] {
+        auto root = locateFile(path);
+        if ((getInode(root).mode & Permissions::DIR) == Permissions::NONE) {
+            throw runtime_error("Illegal path: " + path + " is not a directory");
+        }
+
+        // one pass over the inode table instead of a read for every inode of the tree
+        vector<uint32_t> sizes(getInodeCount()), blockCounts(getInodeCount());
+        unordered_map<size_t, Inode> directoryInodes;
+        auto buffer = pool.acquire();
+        for (InodeIterator iterator(*this); iterator.next();) {
+            auto index = iterator.getIndex();
+            auto &inode = iterator.get();
+            sizes[index] = inode.size;
+            blockCounts[index] = count_if(begin(inode.direct), end(inode.direct), [](uint32_t p) { return p != 0; });
+            if (inode.indirect != 0) { // holes leave pointers empty, so they are counted too
+                disk.read(inode.indirect, buffer.get());
+                auto &pointers = buffer.as<Block>().pointers;
+                blockCounts[index] += 1 + count_if(begin(pointers), end(pointers), [](uint32_t p) { return p != 0; });
+            }
+            if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
+                directoryInodes.emplace(index, inode);
+            }
+        }
+
+        // then directories in the order they are found, so every one comes after its parent
+        vector<pair<size_t, size_t>> directories{{root, SIZE_MAX}}; // inode and position of the parent
+        vector<string> paths{path.ends_with('/') ? path : path + "/"};
+        vector<UsageInfo> usages;
+        for (size_t n = 0; n < directories.size(); n++) {
+            auto index = directories[n].first;
+            auto found = directoryInodes.find(index);
+            if (found == directoryInodes.end()) {
+                throw runtime_error("Inode is broken");
+            }
+            UsageInfo usage{paths[n], 1, 0, 0, (uint64_t) blockCounts[index] * BLOCK_SIZE};
+            auto data = readBlocks(found->second);
+            auto entries = reinterpret_cast<const DirectoryEntry *>(data.data());
+            for (size_t i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
+                if (isFreeEntry(entries[i]) || matchEntry(entries[i], ".") || matchEntry(entries[i], "..")) {
+                    continue;
+                }
+                auto child = entries[i].inode;
+                checkInode(child, true);
+                if (directoryInodes.count(child)) {
+                    directories.emplace_back(child, n);
+                    auto &name = entries[i].filename;
+                    paths.push_back(paths[n] + string(name, strnlen(name, sizeof(name))) + "/");
+                    continue;
+                }
+                usage.files++;
+                usage.bytes += sizes[child];
+                usage.allocated += (uint64_t) blockCounts[child] * BLOCK_SIZE;
+            }
+            usages.push_back(usage);
+        }
+        for (auto n = directories.size() - 1; n > 0; n--) { // children are added to parents bottom up
+            auto &usage = usages[n], &parent = usages[directories[n].second];
+            parent.directories += usage.directories;
+            parent.files += usage.files;
+            parent.bytes += usage.bytes;
+            parent.allocated += usage.allocated;
+        }
+        reverse(usages.begin(), usages.end());
+        return usages;
+    });
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::moveFile(const string &from, const string &to) {
+    Change change(*this);
+    if (from[from.size() - 1] == '/' || to[to.size() - 1] == '/') {
+        throw runtime_error("Moving directory is not supported");
+    }
+    copyFile(from, to);
+    removeFile(from);
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::changeDirectory(const string &path) {
+    currentInodeIndex = readConsistently([&] {
         auto index = locateFile(path);
         auto inode = getInode(index);
         if ((inode.mode & Permissions::DIR) == Permissions::NONE) {
             throw runtime_error("Illegal path: " + path + " is not a directory");
         }
-        data = readInode(index);
-    }
-    auto entries = reinterpret_cast<DirectoryEntry *>(data.data());
-    for (auto i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
-        auto entry = entries[i];
-        stats.emplace_back(string(entry.filename), getInode(entry.inode));
-    }
-    return stats;
+        return index;
+    });
 }
 
-string FileSystem::readFile(const string &path) {
-    auto index = locateFile(path);
-    auto inode = getInode(index);
-    if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
-        throw runtime_error("Reading directory is not allowed");
-    }
-    return readInode(index);
+template<size_t BLOCK_SIZE>
+vector<pair<string, FileSystemBase::InodeBase>> BlockFileSystem<BLOCK_SIZE>::listDirectory(const string &path) {
+    return readConsistently([&] {
+        vector<pair<string, FileSystemBase::InodeBase>> stats;
+        string data;
+        if (path.empty()) {
+            data = readInode(currentInodeIndex);
+        } else {
+            auto index = locateFile(path);
+            auto inode = getInode(index);
+            if ((inode.mode & Permissions::DIR) == Permissions::NONE) {
+                throw runtime_error("Illegal path: " + path + " is not a directory");
+            }
+            data = readInode(index);
+        }
+        auto entries = reinterpret_cast<DirectoryEntry *>(data.data());
+        vector<size_t> indices;
+        vector<string> filenames;
+        for (size_t i = 0; i < data.size() / DIRECTORY_ENTRY_SIZE; i++) {
+            if (!isFreeEntry(entries[i])) {
+                indices.push_back(entries[i].inode);
+                filenames.emplace_back(entries[i].filename, strnlen(entries[i].filename, sizeof(entries[i].filename)));
+            }
+        }
+        auto inodes = getInodes(indices);
+        for (size_t i = 0; i < inodes.size(); i++) {
+            applyDirty(indices[i], inodes[i]);
+            stats.emplace_back(filenames[i], inodes[i]);
+        }
+        return stats;
+    });
 }
 
-void FileSystem::writeFile(const string &path, const string &src) {
+template<size_t BLOCK_SIZE>
+string BlockFileSystem<BLOCK_SIZE>::readFile(const string &path) {
+    return readConsistently([&] {
+        auto index = locateFile(path);
+        auto inode = getInode(index);
+        if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
+            throw runtime_error("Reading directory is not allowed");
+        }
+        return readInode(index);
+    });
+}
+
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::writeFile(const string &path, const string &src) {
+    Change change(*this);
     auto index = locateFile(path);
     auto inode = getInode(index);
     if ((inode.mode & Permissions::DIR) != Permissions::NONE) {
@@ -476,7 +1997,10 @@ void FileSystem::writeFile(const string &path, const string &src) {
     writeInode(index, src);
 }
 
-void FileSystem::changeOwner(const string &path, uint16_t uid) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::changeOwner(const string &path, uint16_t uid) {
+    Change change(*this);
+    checkWritable();
     auto index = locateFile(path);
     if (index == 0) {
         throw runtime_error("Permission denied: uid of root directory cannot be changed");
@@ -486,7 +2010,10 @@ void FileSystem::changeOwner(const string &path, uint16_t uid) {
     setInode(index, inode);
 }
 
-void FileSystem::changeMode(const string &path, Permissions mode) {
+template<size_t BLOCK_SIZE>
+void BlockFileSystem<BLOCK_SIZE>::changeMode(const string &path, Permissions mode) {
+    Change change(*this);
+    checkWritable();
     auto index = locateFile(path);
     if (index == 0) {
         throw runtime_error("Permission denied: mode of root directory cannot be changed");
@@ -500,8 +2027,202 @@ void FileSystem::changeMode(const string &path, Permissions mode) {
     setInode(index, inode);
 }
 
-FileSystem::~FileSystem() {
+template<size_t BLOCK_SIZE>
+BlockFileSystem<BLOCK_SIZE>::~BlockFileSystem() {
     if (disk.mounted()) {
-        disk.unmount();
+        try {
+            unmount();
+        } catch (runtime_error &e) {
+            cerr << "Unable to unmount BFS: " << e.what() << endl;
+        }
+    }
+}
+
+template class BlockFileSystem<4096>;
+template class BlockFileSystem<16384>;
+template class BlockFileSystem<65536>;
+
+FileSystem::FileSystem(Disk &disk) : disk(disk), stats(disk.getStats()) {
+    if (disk.size() < 16) {
+        throw runtime_error("Disk size too small");
     }
 }
+
+FileSystemBase &FileSystem::current() {
+    if (!fs) {
+        throw runtime_error("BFS is not mounted");
+    }
+    return *fs;
+}
+
+void FileSystem::open(size_t blockSize) {
+    unique_ptr<FileSystemBase> (*create)(Disk &);
+    switch (blockSize) { // the only dispatch on block size, checked before the current one is dropped
+        case 4096:
+            create = [](Disk &disk) -> unique_ptr<FileSystemBase> { return make_unique<BlockFileSystem<4096>>(disk); };
+            break;
+        case 16384:
+            create = [](Disk &disk) -> unique_ptr<FileSystemBase> { return make_unique<BlockFileSystem<16384>>(disk); };
+            break;
+        case 65536:
+            create = [](Disk &disk) -> unique_ptr<FileSystemBase> { return make_unique<BlockFileSystem<65536>>(disk); };
+            break;
+        default:
+            throw runtime_error("Unsupported block size " + to_string(blockSize) + ", should be 4096, 16384 or 65536");
+    }
+    fs.reset(); // unmounts the previous one with the block size it was opened with
+    disk.setBlockSize(blockSize);
+    fs = create(disk);
+    fs->setUid(currentUid);
+}
+
+void FileSystem::format(size_t blockSize, bool deduplication) {
+    Scope scope(*this, Tracer::Op::FORMAT, "", deduplication ? "dedup" : "", blockSize);
+    if (currentUid != 0) {
+        throw runtime_error("Permission denied: formatting can only performed by root(uid 0)");
+    }
+    open(blockSize);
+    fs->format(deduplication);
+}
+
+void FileSystem::mount(const string &snapshot, bool readOnly) {
+    Scope scope(*this, Tracer::Op::MOUNT, snapshot, "", readOnly);
+    if (disk.mounted()) {
+        throw runtime_error("A filesystem has already been mounted.");
+    }
+    disk.setBlockSize(Disk::BLOCK_SIZE); // the smallest block size, SuperBlock fits in it
+    vector<char> data(Disk::BLOCK_SIZE);
+    disk.read(0, data);
+    auto super = reinterpret_cast<FileSystemBase::SuperBlock *>(data.data());
+    if (super->magicNumber != FileSystemBase::MAGIC_NUMBER) {
+        throw runtime_error("Unexpected magic number, you should format it first");
+    }
+    open(super->blockSize == 0 ? Disk::BLOCK_SIZE : super->blockSize);
+    fs->mount(snapshot, readOnly);
+}
+
+void FileSystem::unmount() {
+    current().unmount();
+}
+
+void FileSystem::sync() {
+    Scope scope(*this, Tracer::Op::SYNC);
+    current().sync();
+}
+
+FileSystem::SpaceInfo FileSystem::statSpace() {
+    Scope scope(*this, Tracer::Op::STAT_SPACE);
+    return current().statSpace();
+}
+
+void FileSystem::setDiscard(bool enabled) {
+    current().setDiscard(enabled);
+}
+
+void FileSystem::createSnapshot(const string &name) {
+    Scope scope(*this, Tracer::Op::CREATE_SNAPSHOT, name);
+    current().createSnapshot(name);
+}
+
+vector<FileSystem::SnapshotInfo> FileSystem::listSnapshots() {
+    Scope scope(*this, Tracer::Op::LIST_SNAPSHOTS);
+    return current().listSnapshots();
+}
+
+void FileSystem::deleteSnapshot(const string &name) {
+    Scope scope(*this, Tracer::Op::DELETE_SNAPSHOT, name);
+    current().deleteSnapshot(name);
+}
+
+void FileSystem::resetStats() {
+    stats.reset();
+    disk.getStats().reset();
+}
+
+void FileSystem::setTracer(Tracer *newTracer) {
+    tracer = newTracer;
+}
+
+void FileSystem::setUid(uint16_t uid) {
+    Scope scope(*this, Tracer::Op::SET_UID, "", "", uid);
+    currentUid = uid;
+    if (fs) {
+        fs->setUid(uid);
+    }
+}
+
+void FileSystem::createFile(const string &path) {
+    Scope scope(*this, Tracer::Op::CREATE, path);
+    current().createFile(path);
+}
+
+void FileSystem::copyFile(const string &from, const string &to) {
+    Scope scope(*this, Tracer::Op::COPY, from, to);
+    current().copyFile(from, to);
+}
+
+FileSystem::CopyInfo FileSystem::copyTree(const string &from, const string &to) {
+    Scope scope(*this, Tracer::Op::COPY_TREE, from, to);
+    return current().copyTree(from, to);
+}
+
+FileSystem::TarInfo FileSystem::exportTar(const string &from, ostream &archive) {
+    Scope scope(*this, Tracer::Op::EXPORT_TAR, from);
+    return current().exportTar(from, archive);
+}
+
+FileSystem::TarInfo FileSystem::importTar(istream &archive, const string &to) {
+    Scope scope(*this, Tracer::Op::IMPORT_TAR, "", to);
+    return current().importTar(archive, to);
+}
+
+vector<FileSystem::UsageInfo> FileSystem::diskUsage(const string &path) {
+    Scope scope(*this, Tracer::Op::DISK_USAGE, path);
+    return current().diskUsage(path);
+}
+
+void FileSystem::moveFile(const string &from, const string &to) {
+    Scope scope(*this, Tracer::Op::MOVE, from, to);
+    current().moveFile(from, to);
+}
+
+void FileSystem::removeFile(const string &path) {
+    Scope scope(*this, Tracer::Op::REMOVE, path);
+    current().removeFile(path);
+}
+
+FileSystem::InodeBase FileSystem::statFile(const string &path) {
+    Scope scope(*this, Tracer::Op::STAT, path);
+    return current().statFile(path);
+}
+
+vector<pair<string, FileSystem::InodeBase>> FileSystem::listDirectory(const string &path) {
+    Scope scope(*this, Tracer::Op::LIST, path);
+    return current().listDirectory(path);
+}
+
+void FileSystem::changeDirectory(const string &path) {
+    Scope scope(*this, Tracer::Op::CHANGE_DIRECTORY, path);
+    current().changeDirectory(path);
+}
+
+string FileSystem::readFile(const string &path) {
+    Scope scope(*this, Tracer::Op::READ, path);
+    return current().readFile(path);
+}
+
+void FileSystem::writeFile(const string &path, const string &src) {
+    Scope scope(*this, Tracer::Op::WRITE, path);
+    scope.setData(src);
+    current().writeFile(path, src);
+}
+
+void FileSystem::changeOwner(const string &path, uint16_t uid) {
+    Scope scope(*this, Tracer::Op::CHANGE_OWNER, path, "", uid);
+    current().changeOwner(path, uid);
+}
+
+void FileSystem::changeMode(const string &path, Permissions mode) {
+    Scope scope(*this, Tracer::Op::CHANGE_MODE, path, "", static_cast<PermissionsT>(mode));
+    current().changeMode(path, mode);
+}
@@ -2,12 +2,24 @@
 #define _FS_H
 
 #include <string>
+#include <string_view>
+#include <optional>
+#include <bit>
 #include <bitset>
 #include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
 #include <stack>
+#include <memory>
 #include <iostream>
 
 #include "disk.h"
+#include "pool.h"
+#include "discard.h"
+#include "trace.h"
+#include "tar.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -84,24 +96,38 @@ inline ostream &operator<<(ostream &os, Permissions p) {
 }
 
 /*
- * File System: total * 4096B, can be up to 128MB
- * [SuperBlock] [InodeBitMap] [BlockBitMap] [InodeBlock    ...    InodeBlock] [DataBlock ... DataBlock]
- *  1 * 4096B     1 * 4096B     1 * 4096B           total / 16 * 4096B              rest * 4096B
+ * File System: total * blockSize, blockSize is chosen at format time and can be 4K, 16K or 64K
+ * [SuperBlock] [InodeBitMap] [BlockBitMap] [InodeBlock ... InodeBlock] [ReferenceBlock ...] [DataBlock ... DataBlock]
+ *  1 * block     1 * block     1 * block         total / 16 * block      8B * data blocks      rest * block
+ * Bitmaps limit the total to blockSize * 8 blocks, e.g. 128MB for 4K blocks.
+ * ReferenceBlocks only exist if BFS is formatted with deduplication.
  * Inode: 64B
  * [mode] [uid] [size] [creationTime] [modificationTime] [direct ... direct] [indirect]
  *   2B    2B     4B        4B              4B                 4B * 11           4B
+ * A block pointer of 0 is a hole, which is read as zeros and takes no space.
+ *
+ * Snapshot: its own InodeBitMap, map of referred blocks and inode remap table, all in data blocks.
+ * Inode blocks are copied before their first change after a snapshot and the remap table points to copies.
+ * Directory blocks referred to by a snapshot are redirected on write, file blocks are never written in place.
+ * Blocks live BFS frees while a snapshot refers to them are kept in DeadBitMap until it is deleted.
+ *
+ * Generation in SuperBlock is a seqlock for read-only mounts in other processes: it is odd while a public call
+ * writes BFS. A reader takes it before and after a call and retries the call if it changed, so it never waits
+ * for a lock and writers never wait for readers.
  */
 
-class FileSystem {
+// Structures and operations shared by BFS of every block size
+class FileSystemBase {
 public:
     const static uint32_t MAGIC_NUMBER = 0xdeadbeef;
     const static uint32_t DIRECTORY_ENTRY_SIZE = 32;
     const static uint32_t INODE_SIZE = 64;
-    const static uint32_t INODE_COUNT_PER_BLOCK = Disk::BLOCK_SIZE / INODE_SIZE;
-    const static uint32_t POINTER_COUNT_PER_BLOCK = Disk::BLOCK_SIZE / sizeof(uint32_t);
-    const static uint32_t ENTRY_COUNT_PER_BLOCK = Disk::BLOCK_SIZE / DIRECTORY_ENTRY_SIZE;
     const static uint32_t DIRECT_BLOCKS_PER_INODE = INODE_SIZE / 4 - 5;
-    const static uint32_t INDIRECT_BLOCKS_PER_INODE = POINTER_COUNT_PER_BLOCK;
+    const static uint32_t GROUP_COUNT = 8; // allocation groups a bitmap is split into
+    const static size_t MAX_DIRTY_BYTES = 4 * 1024 * 1024; // buffered file data is flushed beyond this
+    static constexpr size_t COPY_WORKERS = 8; // threads reading file data of a recursive copy
+    const static size_t STREAM_BYTES = 1024 * 1024; // file data moved by one I/O of a tar export or import
+    const static size_t READ_ATTEMPTS = 1000; // of a call on a read-only mount before a writer is taken as stuck
 
     struct SuperBlock {
         uint32_t magicNumber; // Magic number to identify filesystem
@@ -109,6 +135,40 @@ public:
         uint32_t inodeBlocks; // Number of inode blocks
         uint32_t inodeOffset; // Offset of first inode block
         uint32_t blockOffset; // Offset of first data block
+        uint32_t clean; // Whether counters below were saved at unmount
+        uint32_t freeBlocks; // Number of free data blocks
+        uint32_t freeInodes; // Number of free inodes
+        uint32_t groupFreeBlocks[GROUP_COUNT]; // Number of free data blocks in each allocation group
+        uint32_t groupFreeInodes[GROUP_COUNT]; // Number of free inodes in each allocation group
+        uint32_t blockSize; // Size of every block, 0 for images formatted before it was configurable (4096)
+        uint32_t referenceBlocks; // Number of reference blocks, 0 if deduplication is off
+        uint32_t referenceOffset; // Offset of first reference block
+        uint32_t snapshotBlock; // Location of the snapshot table, 0 if there is no snapshot
+        uint32_t deadBlock; // Location of DeadBitMap, 0 if there is no snapshot
+        uint32_t generation; // Bumped before and after every change, odd in the middle of one
+        uint32_t stripeMembers; // Number of images, 0 for images formatted before the layout was recorded
+        uint32_t stripeBlocks; // Blocks in every stripe unit, 0 if there is a single image
+    };
+
+    struct Snapshot { // a free slot of the snapshot table has an empty name
+        char name[40];
+        uint32_t creationTime;
+        uint32_t inodeMap; // Location of InodeBitMap at creation
+        uint32_t blockMap; // Location of the map of blocks it refers to, 1: not referred to
+        uint32_t remap[2]; // Locations of the inode remap table: inode block -> its copy, 0 if never changed
+        uint32_t reserved;
+    };
+
+    struct SnapshotInfo {
+        string name;
+        uint32_t creationTime;
+        uint32_t blocks; // Blocks it refers to
+        uint32_t copiedInodeBlocks; // Inode blocks changed since
+    };
+
+    struct BlockReference {
+        uint32_t fingerprint; // Hash of data, 0 if the block must not be shared (directories, indirect pointers)
+        uint32_t count; // Number of pointers to the block
     };
 
     struct InodeBase {
@@ -124,27 +184,194 @@ public:
         uint32_t indirect; // Indirect pointer
     };
 
-    struct DirectoryEntry {
+    struct DirectoryEntry { // a free slot left by removal has an empty filename
         uint32_t inode;
         char filename[DIRECTORY_ENTRY_SIZE - 4];
     };
 
+    struct SpaceInfo {
+        uint32_t blockSize;
+        uint32_t totalBlocks;
+        uint32_t freeBlocks; // Blocks reserved for unsynced data are excluded
+        uint32_t totalInodes;
+        uint32_t freeInodes;
+        vector<pair<uint32_t, uint32_t>> groups; // Free blocks and free inodes of each allocation group on disk
+        bool deduplication;
+        uint32_t savedBlocks; // Blocks that would be taken without deduplication
+        size_t lookups; // Fingerprint lookups since mount
+        size_t hits; // Lookups that found a block with the same data
+        size_t collisions; // Lookups that found a block with the same fingerprint but other data
+    };
+
+    struct CopyInfo {
+        size_t directories; // Directories created, including the target
+        size_t files;
+        size_t bytes; // Size of all files
+        size_t sharedBlocks; // Blocks shared with the source instead of copied
+        double seconds; // Until the copy is synced
+    };
+
+    struct UsageInfo { // of a directory tree
+        string path; // ends with '/'
+        size_t directories; // including itself
+        size_t files;
+        uint64_t bytes; // Size of all files
+        uint64_t allocated; // Bytes of data and indirect blocks of files and directories, shared ones every time
+    };
+
+    struct TarInfo {
+        size_t directories;
+        size_t files;
+        size_t bytes; // Size of all files
+        size_t skipped; // Archive entries that are neither files nor directories
+        double seconds;
+    };
+
+    virtual ~FileSystemBase() = default;
+
+    virtual void format(bool deduplication) = 0;
+
+    virtual void mount(const string &snapshot, bool readOnly) = 0; // read-only if a snapshot is given as well
+
+    virtual void unmount() = 0;
+
+    virtual void sync() = 0;
+
+    virtual SpaceInfo statSpace() = 0;
+
+    virtual void setDiscard(bool enabled) = 0;
+
+    virtual void createSnapshot(const string &name) = 0;
+
+    virtual vector<SnapshotInfo> listSnapshots() = 0;
+
+    virtual void deleteSnapshot(const string &name) = 0;
+
+    virtual void setUid(uint16_t uid) = 0;
+
+    virtual void createFile(const string &path) = 0;
+
+    virtual void copyFile(const string &from, const string &to) = 0;
+
+    virtual CopyInfo copyTree(const string &from, const string &to) = 0;
+
+    virtual TarInfo exportTar(const string &from, ostream &archive) = 0;
+
+    virtual TarInfo importTar(istream &archive, const string &to) = 0;
+
+    // every directory of the tree, each after all directories in it, so the given one comes last
+    virtual vector<UsageInfo> diskUsage(const string &path) = 0;
+
+    virtual void moveFile(const string &from, const string &to) = 0;
+
+    virtual void removeFile(const string &path) = 0;
+
+    virtual InodeBase statFile(const string &path) = 0;
+
+    virtual vector<pair<string, InodeBase>> listDirectory(const string &path) = 0;
+
+    virtual void changeDirectory(const string &path) = 0;
+
+    virtual string readFile(const string &path) = 0;
+
+    virtual void writeFile(const string &path, const string &src) = 0;
+
+    virtual void changeOwner(const string &path, uint16_t uid) = 0;
+
+    virtual void changeMode(const string &path, Permissions mode) = 0;
+};
+
+// BFS with a fixed block size, so that sizes are constants in every loop
+template<size_t BLOCK_SIZE>
+class BlockFileSystem final : public FileSystemBase {
+public:
+    const static uint32_t INODE_COUNT_PER_BLOCK = BLOCK_SIZE / INODE_SIZE;
+    const static uint32_t POINTER_COUNT_PER_BLOCK = BLOCK_SIZE / sizeof(uint32_t);
+    const static uint32_t ENTRY_COUNT_PER_BLOCK = BLOCK_SIZE / DIRECTORY_ENTRY_SIZE;
+    const static uint32_t INDIRECT_BLOCKS_PER_INODE = POINTER_COUNT_PER_BLOCK;
+    const static uint32_t BITS_PER_GROUP = BLOCK_SIZE * 8 / GROUP_COUNT; // bitmap bits covered by one allocation group
+    const static uint32_t REFERENCE_COUNT_PER_BLOCK = BLOCK_SIZE / sizeof(BlockReference);
+    const static uint32_t SNAPSHOT_COUNT_PER_BLOCK = BLOCK_SIZE / sizeof(Snapshot);
+    const static uint32_t STREAM_BLOCKS = max(STREAM_BYTES / BLOCK_SIZE, (size_t) 1);
+
     union Block {
         SuperBlock super;
-        bitset<Disk::BLOCK_SIZE * 8> inodeMap;
-        bitset<Disk::BLOCK_SIZE * 8> blockMap;
+        bitset<BLOCK_SIZE * 8> inodeMap;
+        bitset<BLOCK_SIZE * 8> blockMap;
         Inode inodes[INODE_COUNT_PER_BLOCK];
         uint32_t pointers[POINTER_COUNT_PER_BLOCK];
-        char data[Disk::BLOCK_SIZE];
+        char data[BLOCK_SIZE];
         DirectoryEntry directoryEntries[ENTRY_COUNT_PER_BLOCK];
+        BlockReference references[REFERENCE_COUNT_PER_BLOCK];
+        Snapshot snapshots[SNAPSHOT_COUNT_PER_BLOCK];
     };
 private:
     Disk &disk;
     SuperBlock superBlock;
-    bitset<Disk::BLOCK_SIZE * 8> inodeMap; // 1: free, 0: used
-    bitset<Disk::BLOCK_SIZE * 8> blockMap; // 1: free, 0: used
+    bitset<BLOCK_SIZE * 8> inodeMap; // 1: free, 0: used
+    bitset<BLOCK_SIZE * 8> blockMap; // 1: free, 0: used
     size_t currentInodeIndex = 0; // 0 is root directory
     uint16_t currentUid = 0; // 0 is root
+    struct DirtyFile {
+        string data;
+        uint32_t modificationTime; // of the last write, the inode on disk keeps the old one and its old size
+    };
+
+    map<size_t, DirtyFile> dirtyData; // inode index -> file data whose blocks are not allocated yet
+    size_t dirtyBytes = 0;
+    size_t dirtyBlocks = 0; // blocks reserved for dirtyData
+    set<size_t> sparseDirectories; // directories with many free entries, compacted at sync
+    unique_ptr<Discarder> discarder; // discards freed blocks in background if enabled
+    BlockPool pool{BLOCK_SIZE}; // buffers of every block accessed, no Block lives on the stack
+    vector<BlockReference> references; // of every data block, empty if deduplication is off
+    set<size_t> dirtyReferences; // reference blocks to write with BlockBitMap
+    unordered_map<uint32_t, uint32_t> fingerprints; // fingerprint -> block map index of a block with that data
+    uint32_t savedBlocks = 0;
+    size_t lookups = 0;
+    size_t hits = 0;
+    size_t collisions = 0;
+    bitset<BLOCK_SIZE * 8> heldMap; // 1: referred to by a snapshot, or part of one
+    bitset<BLOCK_SIZE * 8> deadMap; // 1: kept only for snapshots
+    bool deadMapChanged = false;
+    bitset<BLOCK_SIZE * 8> sharedInodeBlocks; // inode blocks some snapshot has no copy of yet
+    bool readOnly = false; // nothing is written, other processes may write BFS meanwhile
+    string mountedSnapshot; // empty if live BFS is mounted
+    vector<uint32_t> inodeRemap; // of the mounted snapshot
+    uint32_t viewGeneration = 1; // generation the maps of a read-only mount were loaded at, never odd once loaded
+    size_t changes = 0; // nested Change of the call in progress
+
+    // used inodes in index order; the inode table is read up to STREAM_BLOCKS blocks at a time, from the block of
+    // the next used inode to the last block of the run that has one, and every Inode is a view into that chunk
+    class InodeIterator {
+    private:
+        BlockFileSystem &fs;
+        vector<char> chunk;
+        size_t first = 0; // inode block number at the start of chunk
+        size_t loaded = 0; // inode blocks in chunk
+        size_t index = SIZE_MAX; // of the current inode
+
+        void load(size_t number);
+
+    public:
+        explicit InodeIterator(BlockFileSystem &fs);
+
+        bool next(); // to the next used inode, false after the last one
+
+        [[nodiscard]] size_t getIndex() const { return index; }
+
+        [[nodiscard]] const Inode &get() const; // valid until next()
+    };
+
+    // held by every public call that writes, keeps the generation odd until the outermost one returns
+    class Change {
+    private:
+        BlockFileSystem &fs;
+
+    public:
+        explicit Change(BlockFileSystem &fs);
+
+        ~Change();
+    };
 
     static uint32_t getTime();
 
@@ -156,36 +383,247 @@ private:
 
     void setInodeMap(size_t index, bool free);
 
+    void markInode(size_t index, bool free);
+
+    void writeInodeMap();
+
     void setBlockMap(size_t index, bool free);
 
+    void markBlock(size_t index, bool free);
+
+    void writeSuperBlock();
+
+    void rebuildCounters();
+
+    static uint32_t countBits(const char *bitmap, size_t from, size_t to);
+
+    size_t getInodeCount();
+
+    void writeBlockMap();
+
+    void loadReferences();
+
+    void writeReferences();
+
+    void shareBlock(size_t index);
+
+    void releaseBlock(size_t index);
+
+    static uint32_t fingerprint(const char *data);
+
+    size_t findDuplicate(const char *data, uint32_t print);
+
+    size_t freeBlockCount();
+
+    static size_t getBlockCount(size_t size);
+
+    vector<size_t> allocateBlocks(size_t count);
+
+    vector<uint32_t> getPointers(const Inode &inode, size_t count);
+
+    vector<size_t> collectBlocks(const Inode &inode);
+
+    static bool isZeroBlock(const char *data);
+
     void checkInode(size_t index, bool shouldBeUsed = false);
 
     void checkBlock(size_t index);
 
     Inode getInode(size_t index);
 
+    vector<Inode> getInodes(const vector<size_t> &indices); // bulk getInode
+
     void setInode(size_t index, Inode inode);
 
     size_t createInode(Permissions mode = Permissions::OWN_RW | Permissions::GRP_R | Permissions::OTH_R);
 
-    void removeInode(size_t index);
+    void removeInode(size_t index, const Inode &inode);
 
     string readInode(size_t index);
 
+    string readBlocks(const Inode &inode); // data on disk, without checks
+
     void writeInode(size_t index, const string &src);
 
-    int writeBlocks(const string &src, uint32_t *begin, const uint32_t *end, int offset);
+    void writeDirectory(size_t index, Inode &inode, const string &src); // in place, without checks
+
+    void truncateBlocks(Inode &inode, size_t count); // only in memory, callers write BlockBitMap
+
+    static bool isFreeEntry(const DirectoryEntry &entry);
+
+    static bool matchEntry(const DirectoryEntry &entry, string_view name); // compared in place, never a free one
+
+    // inode of the entry called name, SIZE_MAX if there is none; reads blocks into pooled buffers, allocates nothing
+    size_t findEntry(size_t directory, string_view name);
+
+    void writeEntry(size_t index, size_t slot, const DirectoryEntry &entry);
+
+    void compactDirectory(size_t index);
+
+    size_t shareBlocks(const Inode &source, Inode &target); // only in memory, callers write BlockBitMap
+
+    void checkWritable();
+
+    uint32_t readGeneration();
+
+    void loadView(); // SuperBlock and maps a read-only mount sees, of live BFS or the mounted snapshot
+
+    // runs read until no writer changed BFS during it, every call of a read-only mount goes through it
+    template<typename Read>
+    auto readConsistently(Read read) -> decltype(read());
+
+    vector<Snapshot> readSnapshots();
+
+    void writeSnapshots(const vector<Snapshot> &snapshots);
+
+    vector<uint32_t> readRemap(const Snapshot &snapshot);
+
+    void loadSnapshots();
+
+    void copyInodeBlock(size_t number);
+
+    void redirectBlock(uint32_t &location); // moves a block referred to by a snapshot before it is written
+
+    // streams file data to archive in runs of at most STREAM_BLOCKS, holes are written as zeros
+    void exportBlocks(const Inode &inode, ostream &archive, span<char> chunk);
+
+    // takes the data of a new file from archive chunk by chunk instead of buffering all of it
+    void importBlocks(size_t index, istream &archive, uint64_t size, span<char> chunk);
+
+    void setAttributes(size_t index, const Tar::Entry &entry); // mode, owner and modification time of an archive
+
+    void bufferInode(size_t index, const string &src);
+
+    void commitDirty(); // allocates and writes all buffered data, without compacting directories
+
+    void commitInode(size_t index, const string &src, uint32_t modificationTime);
+
+    void applyDirty(size_t index, InodeBase &inode); // size and modification time of buffered data, if any
+
+    // writes src from offset to the blocks of pointers, allocating missing ones, returns the offset it stops at
+    size_t writeBlocks(span<const char> src, span<uint32_t> pointers, size_t offset);
 
     void initDirectory(size_t index, size_t parent);
 
-    size_t locateFile(const string &path);
+    size_t locateFile(string_view path);
 
-    size_t locateParent(const string &path);
+    size_t locateParent(string_view path);
 
 public:
-    void format();
+    void format(bool deduplication) override;
+
+    void mount(const string &snapshot, bool readOnly) override;
+
+    void unmount() override;
+
+    void sync() override;
+
+    SpaceInfo statSpace() override;
+
+    void setDiscard(bool enabled) override;
+
+    void createSnapshot(const string &name) override;
+
+    vector<SnapshotInfo> listSnapshots() override;
+
+    void deleteSnapshot(const string &name) override;
+
+    void setUid(uint16_t uid) override;
+
+    void createFile(const string &path) override;
+
+    void copyFile(const string &from, const string &to) override;
+
+    CopyInfo copyTree(const string &from, const string &to) override;
+
+    TarInfo exportTar(const string &from, ostream &archive) override;
+
+    TarInfo importTar(istream &archive, const string &to) override;
+
+    vector<UsageInfo> diskUsage(const string &path) override;
+
+    void moveFile(const string &from, const string &to) override;
+
+    void removeFile(const string &path) override;
+
+    InodeBase statFile(const string &path) override;
+
+    vector<pair<string, InodeBase>> listDirectory(const string &path) override;
 
-    void mount();
+    void changeDirectory(const string &path) override;
+
+    string readFile(const string &path) override;
+
+    void writeFile(const string &path, const string &src) override;
+
+    void changeOwner(const string &path, uint16_t uid) override;
+
+    void changeMode(const string &path, Permissions mode) override;
+
+    explicit BlockFileSystem(Disk &disk);
+
+    ~BlockFileSystem() override;
+};
+
+// Entry of BFS, which picks BlockFileSystem of the right block size once at format or mount time
+class FileSystem {
+public:
+    using InodeBase = FileSystemBase::InodeBase;
+    using SpaceInfo = FileSystemBase::SpaceInfo;
+    using CopyInfo = FileSystemBase::CopyInfo;
+    using SnapshotInfo = FileSystemBase::SnapshotInfo;
+    using TarInfo = FileSystemBase::TarInfo;
+    using UsageInfo = FileSystemBase::UsageInfo;
+
+private:
+    Disk &disk;
+    unique_ptr<FileSystemBase> fs; // null until formatted or mounted
+    uint16_t currentUid = 0; // 0 is root
+    Tracer *tracer = nullptr; // records public calls if set
+    OperationStats stats;
+
+    // a public call, which is traced and counted
+    class Scope {
+    private:
+        Tracer::Scope trace;
+        OperationStats::Scope count;
+
+    public:
+        Scope(FileSystem &fs, Tracer::Op op, const string &path = "", const string &target = "", uint32_t number = 0)
+            : trace(fs.tracer, op, path, target, number), count(fs.stats, op) {}
+
+        void setData(const string &data) { trace.setData(data); }
+    };
+
+    FileSystemBase &current();
+
+    void open(size_t blockSize);
+
+public:
+    void format(size_t blockSize = Disk::BLOCK_SIZE, bool deduplication = false);
+
+    // read-only if a snapshot is given as well, then the image may be written by another process meanwhile
+    void mount(const string &snapshot = "", bool readOnly = false);
+
+    void unmount();
+
+    void sync();
+
+    SpaceInfo statSpace();
+
+    void setDiscard(bool enabled);
+
+    void createSnapshot(const string &name);
+
+    vector<SnapshotInfo> listSnapshots();
+
+    void deleteSnapshot(const string &name);
+
+    void setTracer(Tracer *newTracer);
+
+    [[nodiscard]] const OperationStats &getStats() const { return stats; }
+
+    void resetStats(); // and those of the disk
 
     void setUid(uint16_t uid);
 
@@ -193,6 +631,14 @@ public:
 
     void copyFile(const string &from, const string &to);
 
+    CopyInfo copyTree(const string &from, const string &to);
+
+    TarInfo exportTar(const string &from, ostream &archive);
+
+    TarInfo importTar(istream &archive, const string &to);
+
+    vector<UsageInfo> diskUsage(const string &path);
+
     void moveFile(const string &from, const string &to);
 
     void removeFile(const string &path);
@@ -212,9 +658,6 @@ public:
     void changeMode(const string &path, Permissions mode);
 
     explicit FileSystem(Disk &disk);
-
-    ~FileSystem();
-
 };
 
 #endif // _FS_H
@@ -0,0 +1,38 @@
+#include <new>
+
+#include "pool.h"
+
+BlockPool::Buffer::Buffer(BlockPool *pool, char *data) : pool(pool), data(data) {}
+
+BlockPool::Buffer::Buffer(Buffer &&other) noexcept : pool(other.pool), data(other.data) {
+    other.data = nullptr;
+}
+
+BlockPool::Buffer::~Buffer() {
+    if (data != nullptr) {
+        pool->release(data);
+    }
+}
+
+BlockPool::BlockPool(size_t blockSize) : blockSize(blockSize) {}
+
+BlockPool::~BlockPool() {
+    for (auto data: idle) {
+        ::operator delete(data, align_val_t(blockSize));
+    }
+}
+
+BlockPool::Buffer BlockPool::acquire() {
+    lock_guard<mutex> lock(idleMutex);
+    if (idle.empty()) { // only until as many buffers as are ever used at once exist
+        return {this, static_cast<char *>(::operator new(blockSize, align_val_t(blockSize)))};
+    }
+    auto data = idle.back();
+    idle.pop_back();
+    return {this, data};
+}
+
+void BlockPool::release(char *data) {
+    lock_guard<mutex> lock(idleMutex);
+    idle.push_back(data);
+}
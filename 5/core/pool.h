@@ -0,0 +1,60 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <vector>
+#include <span>
+#include <mutex>
+
+using namespace std;
+
+/*
+ * Block sized buffers aligned to the block size, kept for reuse once released,
+ * so that hot paths neither allocate nor zero a block for every access.
+ * Buffers may be acquired from several threads, each buffer is used by one of them.
+ */
+class BlockPool {
+public:
+    class Buffer {
+    private:
+        BlockPool *pool;
+        char *data;
+
+    public:
+        Buffer(BlockPool *pool, char *data);
+
+        Buffer(Buffer &&other) noexcept;
+
+        Buffer(const Buffer &) = delete;
+
+        Buffer &operator=(const Buffer &) = delete;
+
+        ~Buffer();
+
+        [[nodiscard]] span<char> get() const { return {data, pool->blockSize}; }
+
+        // views the block as one of the on-disk layouts
+        template<typename T>
+        T &as() const { return *reinterpret_cast<T *>(data); }
+    };
+
+private:
+    size_t blockSize;
+    mutex idleMutex;
+    vector<char *> idle;
+
+    void release(char *data);
+
+public:
+    explicit BlockPool(size_t blockSize);
+
+    BlockPool(const BlockPool &) = delete;
+
+    BlockPool &operator=(const BlockPool &) = delete;
+
+    ~BlockPool();
+
+    // the content is whatever its previous user left
+    Buffer acquire();
+};
+
+#endif // _POOL_H
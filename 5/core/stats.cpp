@@ -0,0 +1,157 @@
+#include <bit>
+
+#include "stats.h"
+
+size_t Histogram::getBucket(uint64_t value) {
+    if (value < SUB_BUCKETS) { // exact below the first power of two that is split
+        return value;
+    }
+    auto exponent = bit_width(value) - 1; // at least log2(SUB_BUCKETS)
+    auto shift = exponent - countr_zero(SUB_BUCKETS);
+    return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t Histogram::getUpperBound(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    auto shift = bucket / SUB_BUCKETS - 1;
+    auto lower = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+void Histogram::record(uint64_t value) {
+    buckets[getBucket(value)].fetch_add(1, memory_order_relaxed);
+    samples.fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(value, memory_order_relaxed);
+    auto current = maximum.load(memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, memory_order_relaxed));
+}
+
+uint64_t Histogram::percentile(double p) const {
+    auto count = samples.load(memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+    auto rank = max((uint64_t) 1, (uint64_t) (p * count + 0.5)); // the sample of this rank, counted from 1
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += buckets[i].load(memory_order_relaxed);
+        if (seen >= rank) {
+            return min(getUpperBound(i), maximum.load(memory_order_relaxed));
+        }
+    }
+    return maximum.load(memory_order_relaxed);
+}
+
+Histogram::Summary Histogram::summarize() const {
+    auto count = samples.load(memory_order_relaxed);
+    return {
+        count, count == 0 ? 0 : sum.load(memory_order_relaxed) / count,
+        percentile(0.5), percentile(0.9), percentile(0.99), maximum.load(memory_order_relaxed)
+    };
+}
+
+void Histogram::reset() {
+    for (auto &bucket: buckets) {
+        bucket.store(0, memory_order_relaxed);
+    }
+    samples.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    maximum.store(0, memory_order_relaxed);
+}
+
+static uint64_t elapsed(chrono::steady_clock::time_point start) {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+void DiskStats::recordRead(size_t blocks, size_t bytes, chrono::steady_clock::time_point start) {
+    readLatency.record(elapsed(start));
+    reads.fetch_add(1, memory_order_relaxed);
+    readBlocks.fetch_add(blocks, memory_order_relaxed);
+    readBytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+void DiskStats::recordWrite(size_t blocks, size_t bytes, chrono::steady_clock::time_point start) {
+    writeLatency.record(elapsed(start));
+    writes.fetch_add(1, memory_order_relaxed);
+    writtenBlocks.fetch_add(blocks, memory_order_relaxed);
+    writtenBytes.fetch_add(bytes, memory_order_relaxed);
+}
+
+void DiskStats::recordDiscard(size_t blocks) {
+    discards.fetch_add(1, memory_order_relaxed);
+    discardedBlocks.fetch_add(blocks, memory_order_relaxed);
+}
+
+void DiskStats::reset() {
+    for (auto counter: {&reads, &writes, &readBlocks, &writtenBlocks, &readBytes, &writtenBytes, &discards,
+                        &discardedBlocks}) {
+        counter->store(0, memory_order_relaxed);
+    }
+    readLatency.reset();
+    writeLatency.reset();
+}
+
+OperationStats::Scope::Scope(OperationStats &stats, Tracer::Op op)
+    : stats(stats), op(op), nested(stats.depth++ > 0), exceptions(uncaught_exceptions()),
+      reads(stats.disk.reads), writes(stats.disk.writes),
+      readBlocks(stats.disk.readBlocks), writtenBlocks(stats.disk.writtenBlocks),
+      start(chrono::steady_clock::now()) {}
+
+OperationStats::Scope::~Scope() {
+    stats.depth--;
+    if (nested) {
+        return;
+    }
+    auto &entry = stats.entries[(size_t) op];
+    entry.latency.record(elapsed(start));
+    entry.calls++;
+    entry.failures += uncaught_exceptions() > exceptions;
+    entry.reads += stats.disk.reads - reads;
+    entry.writes += stats.disk.writes - writes;
+    entry.readBlocks += stats.disk.readBlocks - readBlocks;
+    entry.writtenBlocks += stats.disk.writtenBlocks - writtenBlocks;
+}
+
+OperationStats::OperationStats(const DiskStats &disk) : disk(disk) {}
+
+void OperationStats::reset() {
+    for (auto &entry: entries) {
+        entry.calls = entry.failures = entry.reads = entry.writes = entry.readBlocks = entry.writtenBlocks = 0;
+        entry.latency.reset();
+    }
+}
+
+static void dumpLatency(ostream &out, const Histogram &histogram) {
+    auto summary = histogram.summarize();
+    out << "{\"count\":" << summary.count << ",\"mean\":" << summary.mean << ",\"p50\":" << summary.p50
+        << ",\"p90\":" << summary.p90 << ",\"p99\":" << summary.p99 << ",\"max\":" << summary.max << "}";
+}
+
+void OperationStats::dump(ostream &out) const {
+    out << "{\"disk\":{\"reads\":" << disk.reads << ",\"writes\":" << disk.writes
+        << ",\"readBlocks\":" << disk.readBlocks << ",\"writtenBlocks\":" << disk.writtenBlocks
+        << ",\"readBytes\":" << disk.readBytes << ",\"writtenBytes\":" << disk.writtenBytes
+        << ",\"discards\":" << disk.discards << ",\"discardedBlocks\":" << disk.discardedBlocks
+        << ",\"readLatencyNs\":";
+    dumpLatency(out, disk.readLatency);
+    out << ",\"writeLatencyNs\":";
+    dumpLatency(out, disk.writeLatency);
+    out << "},\"operations\":{";
+    auto first = true;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto &entry = entries[i];
+        if (entry.calls == 0) {
+            continue;
+        }
+        out << (first ? "" : ",") << "\"" << Tracer::getName((Tracer::Op) i) << "\":{\"calls\":" << entry.calls
+            << ",\"failures\":" << entry.failures << ",\"reads\":" << entry.reads << ",\"writes\":" << entry.writes
+            << ",\"readBlocks\":" << entry.readBlocks << ",\"writtenBlocks\":" << entry.writtenBlocks
+            << ",\"latencyNs\":";
+        dumpLatency(out, entry.latency);
+        out << "}";
+        first = false;
+    }
+    out << "}}" << endl;
+}
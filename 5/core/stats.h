@@ -0,0 +1,119 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include "trace.h"
+
+using namespace std;
+
+/*
+ * Log-linear latency histogram: every power of two of nanoseconds is split into SUB_BUCKETS linear buckets,
+ * so a percentile is off by at most 1/SUB_BUCKETS of its value. Recording is a few relaxed atomic adds,
+ * samples may come from several threads.
+ */
+class Histogram {
+public:
+    const static size_t SUB_BUCKETS = 8;
+    const static size_t BUCKETS = 64 * SUB_BUCKETS;
+
+    struct Summary {
+        uint64_t count;
+        uint64_t mean;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t max;
+    };
+
+private:
+    array<atomic<uint64_t>, BUCKETS> buckets{};
+    atomic<uint64_t> samples = 0;
+    atomic<uint64_t> sum = 0;
+    atomic<uint64_t> maximum = 0;
+
+    static size_t getBucket(uint64_t value);
+
+    static uint64_t getUpperBound(size_t bucket);
+
+public:
+    void record(uint64_t value);
+
+    [[nodiscard]] uint64_t percentile(double p) const; // upper bound of the bucket the sample falls in
+
+    [[nodiscard]] Summary summarize() const;
+
+    void reset();
+};
+
+// I/O of a Disk, in blocks of its block size at the time
+struct DiskStats {
+    atomic<uint64_t> reads = 0;
+    atomic<uint64_t> writes = 0;
+    atomic<uint64_t> readBlocks = 0;
+    atomic<uint64_t> writtenBlocks = 0;
+    atomic<uint64_t> readBytes = 0;
+    atomic<uint64_t> writtenBytes = 0;
+    atomic<uint64_t> discards = 0;
+    atomic<uint64_t> discardedBlocks = 0;
+    Histogram readLatency; // ns
+    Histogram writeLatency;
+
+    void recordRead(size_t blocks, size_t bytes, chrono::steady_clock::time_point start);
+
+    void recordWrite(size_t blocks, size_t bytes, chrono::steady_clock::time_point start);
+
+    void recordDiscard(size_t blocks);
+
+    void reset();
+};
+
+// calls of every public FileSystem operation and the disk I/O they cost, nested calls count for the outer one
+class OperationStats {
+public:
+    struct Entry {
+        uint64_t calls;
+        uint64_t failures; // calls that threw
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t readBlocks;
+        uint64_t writtenBlocks;
+        Histogram latency; // ns
+    };
+
+    class Scope {
+    private:
+        OperationStats &stats;
+        Tracer::Op op;
+        bool nested;
+        int exceptions;
+        uint64_t reads, writes, readBlocks, writtenBlocks; // of the disk when the call started
+        chrono::steady_clock::time_point start;
+
+    public:
+        Scope(OperationStats &stats, Tracer::Op op);
+
+        ~Scope();
+    };
+
+private:
+    const DiskStats &disk;
+    array<Entry, (size_t) Tracer::Op::COUNT> entries{};
+    int depth = 0;
+
+public:
+    explicit OperationStats(const DiskStats &disk);
+
+    [[nodiscard]] const DiskStats &getDisk() const { return disk; }
+
+    [[nodiscard]] const Entry &get(Tracer::Op op) const { return entries[(size_t) op]; }
+
+    void reset(); // of operations only, the disk resets its own
+
+    void dump(ostream &out) const; // everything as one JSON object
+};
+
+#endif // _STATS_H
@@ -0,0 +1,88 @@
+#include <future>
+#include <tuple>
+
+#include "stripedDisk.h"
+
+StripedDisk::StripedDisk(const vector<string> &paths, size_t stripeBlocks) : stripeBlocks(stripeBlocks) {
+    if (paths.empty() || stripeBlocks == 0) {
+        throw runtime_error("Invalid stripe layout");
+    }
+    for (const auto &path: paths) {
+        members.push_back(make_unique<Disk>(path.c_str()));
+    }
+    setBlockSize(blockSize);
+}
+
+void StripedDisk::setBlockSize(size_t size) {
+    blockSize = size;
+    auto memberBlocks = SIZE_MAX;
+    for (auto &member: members) {
+        member->setBlockSize(size);
+        memberBlocks = min(memberBlocks, member->size());
+    }
+    // every image holds the same number of whole stripe units
+    blocks = memberBlocks / stripeBlocks * stripeBlocks * members.size();
+}
+
+void StripedDisk::forEachPiece(unsigned int index, size_t count,
+                               const function<void(Disk &, unsigned int, size_t, size_t)> &io) {
+    vector<vector<tuple<unsigned int, size_t, size_t>>> pieces(members.size()); // per member
+    for (size_t offset = 0; offset < count;) {
+        auto block = index + offset;
+        auto unit = block / stripeBlocks;
+        auto length = min(stripeBlocks - block % stripeBlocks, count - offset);
+        auto memberIndex = unit / members.size() * stripeBlocks + block % stripeBlocks;
+        pieces[unit % members.size()].emplace_back(memberIndex, offset, length);
+        offset += length;
+    }
+    auto work = [this, &pieces, &io](size_t i) {
+        for (auto[memberIndex, offset, length]: pieces[i]) {
+            io(*members[i], memberIndex, offset, length);
+        }
+    };
+    vector<size_t> touched;
+    for (size_t i = 0; i < members.size(); i++) {
+        if (!pieces[i].empty()) {
+            touched.push_back(i);
+        }
+    }
+    if (touched.empty()) {
+        return;
+    }
+    vector<future<void>> pending;
+    for (size_t i = 1; i < touched.size(); i++) {
+        pending.push_back(async(launch::async, work, touched[i]));
+    }
+    work(touched[0]); // the calling thread takes one member, so small requests spawn nothing
+    for (auto &f: pending) {
+        f.get(); // rethrows errors of members
+    }
+}
+
+void StripedDisk::read(unsigned int index, span<char> data) {
+    auto count = checkParams(index, data);
+    auto start = chrono::steady_clock::now();
+    forEachPiece(index, count, [this, data](Disk &member, unsigned int memberIndex, size_t offset, size_t length) {
+        member.read(memberIndex, data.subspan(offset * blockSize, length * blockSize));
+    });
+    stats.recordRead(count, data.size(), start);
+}
+
+void StripedDisk::write(unsigned int index, span<const char> data) {
+    auto count = checkParams(index, data);
+    auto start = chrono::steady_clock::now();
+    forEachPiece(index, count, [this, data](Disk &member, unsigned int memberIndex, size_t offset, size_t length) {
+        member.write(memberIndex, data.subspan(offset * blockSize, length * blockSize));
+    });
+    stats.recordWrite(count, data.size(), start);
+}
+
+void StripedDisk::discard(unsigned int index, size_t count) {
+    if (index >= blocks || count > blocks - index) {
+        throw runtime_error("Invalid block index");
+    }
+    forEachPiece(index, count, [](Disk &member, unsigned int memberIndex, size_t, size_t length) {
+        member.discard(memberIndex, length);
+    });
+    stats.recordDiscard(count);
+}
@@ -0,0 +1,46 @@
+#ifndef _STRIPED_DISK_H
+#define _STRIPED_DISK_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "disk.h"
+
+/*
+ * RAID-0 over several images: block `index` lives in stripe unit `index / stripeBlocks`,
+ * and stripe units are dealt to the images in turn.
+ * Image:   0        1        2        0        1    ...
+ * Unit:    [0]      [1]      [2]      [3]      [4]  ...
+ * A request spanning several images is split, and the images are accessed in parallel.
+ * The layout is recorded in SuperBlock at format, mounting with another one is refused.
+ */
+class StripedDisk : public Disk {
+private:
+    vector<unique_ptr<Disk>> members;
+    size_t stripeBlocks;
+
+    // calls `io(member, memberIndex, offset, count)` for every piece of the request, one thread per member
+    void forEachPiece(unsigned int index, size_t count,
+                      const function<void(Disk &, unsigned int, size_t, size_t)> &io);
+
+public:
+    const static size_t DEFAULT_STRIPE_BLOCKS = 16; // 64 KiB with 4 KiB blocks, 1 MiB with 64 KiB ones
+
+    StripedDisk(const vector<string> &paths, size_t stripeBlocks = DEFAULT_STRIPE_BLOCKS);
+
+    [[nodiscard]] size_t getMembers() const override { return members.size(); }
+
+    [[nodiscard]] size_t getStripeBlocks() const override { return stripeBlocks; }
+
+    void setBlockSize(size_t size) override;
+
+    void read(unsigned int index, span<char> data) override;
+
+    void write(unsigned int index, span<const char> data) override;
+
+    void discard(unsigned int index, size_t count) override;
+};
+
+#endif // _STRIPED_DISK_H
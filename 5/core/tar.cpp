@@ -0,0 +1,141 @@
+#include <cstring>
+#include <charconv>
+#include <numeric>
+#include <exception>
+
+#include "tar.h"
+
+static_assert(sizeof(Tar::Header) == Tar::RECORD_SIZE);
+
+template<size_t N>
+static void putOctal(char (&field)[N], uint64_t value) {
+    snprintf(field, N, "%0*llo", (int) N - 1, (unsigned long long) value);
+}
+
+template<size_t N>
+static uint64_t getOctal(const char (&field)[N]) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < N && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+template<size_t N>
+static string getString(const char (&field)[N]) {
+    return {field, strnlen(field, N)};
+}
+
+static uint32_t checksum(const Tar::Header &header) { // the checksum field is taken as spaces
+    auto bytes = reinterpret_cast<const unsigned char *>(&header);
+    auto sum = accumulate(bytes, bytes + Tar::RECORD_SIZE, 0u);
+    for (auto c: header.checksum) {
+        sum = sum - (unsigned char) c + ' ';
+    }
+    return sum;
+}
+
+static uint64_t getPadding(uint64_t size) {
+    return (Tar::RECORD_SIZE - size % Tar::RECORD_SIZE) % Tar::RECORD_SIZE;
+}
+
+void Tar::writeHeader(ostream &out, const Entry &entry) {
+    Header header{};
+    auto &path = entry.path;
+    if (path.length() <= sizeof(header.name)) {
+        memcpy(header.name, path.data(), path.length());
+    } else { // split at the first slash that leaves a name short enough
+        auto slash = path.find('/', path.length() - sizeof(header.name) - 1);
+        if (slash == string::npos || slash > sizeof(header.prefix) || slash == path.length() - 1) {
+            throw runtime_error("Path is too long for tar: " + path);
+        }
+        memcpy(header.prefix, path.data(), slash);
+        memcpy(header.name, path.data() + slash + 1, path.length() - slash - 1);
+    }
+    putOctal(header.mode, entry.mode);
+    putOctal(header.uid, entry.uid);
+    putOctal(header.gid, 0);
+    putOctal(header.size, entry.size);
+    putOctal(header.modificationTime, entry.modificationTime);
+    header.type = entry.type;
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum(header)); // followed by NUL and a space
+    header.checksum[7] = ' ';
+    out.write(reinterpret_cast<const char *>(&header), RECORD_SIZE);
+}
+
+bool Tar::readHeader(istream &in, Entry &entry) {
+    string longPath; // given by an extension header for the next entry
+    while (true) {
+        Header header;
+        if (!in.read(reinterpret_cast<char *>(&header), RECORD_SIZE) || header.name[0] == '\0') {
+            return false; // a record of zeros ends the archive, a truncated one is taken as its end as well
+        }
+        if (getOctal(header.checksum) != checksum(header)) {
+            throw runtime_error("Broken tar header");
+        }
+        entry.type = header.type == '\0' ? '0' : header.type;
+        entry.mode = getOctal(header.mode) & 0777;
+        entry.uid = getOctal(header.uid);
+        entry.size = getOctal(header.size);
+        entry.modificationTime = getOctal(header.modificationTime);
+        if (entry.type == 'L' || entry.type == 'x') { // GNU long name or pax attributes
+            if (entry.size > MAX_EXTENSION_SIZE) { // checked before the size read from the archive is allocated
+                throw runtime_error("Broken tar header");
+            }
+            string data(entry.size, '\0');
+            if (!in.read(data.data(), (streamsize) data.size())) {
+                throw runtime_error("Unexpected end of tar archive");
+            }
+            skipPadding(in, entry.size);
+            if (entry.type == 'L') {
+                longPath = data.c_str();
+                continue;
+            }
+            for (size_t i = 0; i < data.size();) { // records of "<length> <key>=<value>\n", length counts all of it
+                size_t length = 0;
+                auto[end, error] = from_chars(data.data() + i, data.data() + data.size(), length);
+                if (error != errc() || length == 0 || length > data.size() - i) {
+                    throw runtime_error("Broken tar header");
+                }
+                string_view record(data.data() + i, length);
+                auto key = (size_t) (end - data.data()) - i + 1;
+                auto equals = record.find('=', key);
+                if (key >= length || record[key - 1] != ' ' || equals == string_view::npos || record.back() != '\n') {
+                    throw runtime_error("Broken tar header");
+                }
+                if (record.substr(key, equals - key) == "path") {
+                    longPath = record.substr(equals + 1, length - equals - 2);
+                }
+                i += length;
+            }
+            continue;
+        }
+        auto prefix = getString(header.prefix);
+        entry.path = !longPath.empty() ? longPath : prefix.empty() ? getString(header.name)
+                                                                   : prefix + "/" + getString(header.name);
+        if (entry.type == '5' && entry.path.back() != '/') {
+            entry.path += '/';
+        }
+        return true;
+    }
+}
+
+void Tar::writePadding(ostream &out, uint64_t size) {
+    static const char zeros[RECORD_SIZE]{};
+    out.write(zeros, (streamsize) getPadding(size));
+}
+
+void Tar::skipPadding(istream &in, uint64_t size) {
+    in.ignore((streamsize) getPadding(size));
+}
+
+void Tar::skip(istream &in, uint64_t size) {
+    in.ignore((streamsize) (size + getPadding(size)));
+}
+
+void Tar::writeEnd(ostream &out) {
+    static const char zeros[2 * RECORD_SIZE]{};
+    out.write(zeros, sizeof(zeros));
+}
@@ -0,0 +1,62 @@
+#ifndef _TAR_H
+#define _TAR_H
+
+#include <string>
+#include <iostream>
+
+using namespace std;
+
+/*
+ * POSIX ustar archive: [Header] [Data padded to 512B] [Header] [Data] ... [512B of zeros] [512B of zeros]
+ * Header: [name] [mode] [uid] [gid] [size] [mtime] [checksum] [type] [linkname] [magic] [version] ... [prefix]
+ *          100B    8B    8B    8B    12B     12B      8B       1B      100B       6B      2B              155B
+ * Numbers are octal strings, a path longer than name is split at a slash into prefix and name.
+ */
+class Tar {
+public:
+    const static size_t RECORD_SIZE = 512;
+    const static size_t MAX_EXTENSION_SIZE = 64 * 1024; // of a long name or pax attributes, larger ones are broken
+
+    struct Header {
+        char name[100];
+        char mode[8];
+        char uid[8];
+        char gid[8];
+        char size[12];
+        char modificationTime[12];
+        char checksum[8];
+        char type;
+        char linkName[100];
+        char magic[6];
+        char version[2];
+        char userName[32];
+        char groupName[32];
+        char deviceMajor[8];
+        char deviceMinor[8];
+        char prefix[155];
+        char padding[12];
+    };
+
+    struct Entry {
+        string path; // directories end with '/'
+        char type; // '0' for files, '5' for directories, others are skipped on import
+        uint16_t mode; // permission bits only
+        uint16_t uid;
+        uint64_t size;
+        uint32_t modificationTime;
+    };
+
+    static void writeHeader(ostream &out, const Entry &entry);
+
+    static bool readHeader(istream &in, Entry &entry); // false at the end of the archive
+
+    static void writePadding(ostream &out, uint64_t size); // after size bytes of data
+
+    static void skipPadding(istream &in, uint64_t size); // after size bytes of data
+
+    static void skip(istream &in, uint64_t size); // data of size bytes and its padding
+
+    static void writeEnd(ostream &out);
+};
+
+#endif // _TAR_H
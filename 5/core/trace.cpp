@@ -0,0 +1,134 @@
+#include <random>
+#include <cstring>
+#include <exception>
+#include <algorithm>
+
+#include "trace.h"
+
+template<typename T>
+static void put(ostream &out, T value) {
+    out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template<typename T>
+static bool get(istream &in, T &value) {
+    return (bool) in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+Tracer::Tracer(const string &path, uint64_t blocks) : out(path, ios::binary), start(chrono::steady_clock::now()) {
+    if (out.fail()) {
+        throw runtime_error("Unable to open " + path);
+    }
+    put(out, MAGIC_NUMBER);
+    put(out, VERSION);
+    put(out, blocks);
+}
+
+Tracer::~Tracer() {
+    out.flush();
+}
+
+static void putString(ostream &out, const string &str) {
+    put<uint16_t>(out, str.length());
+    out.write(str.data(), str.length());
+}
+
+static bool getString(istream &in, string &str) {
+    uint16_t length;
+    if (!get(in, length)) {
+        return false;
+    }
+    str.resize(length);
+    return (bool) in.read(str.data(), length);
+}
+
+void Tracer::write(const Record &record) {
+    put(out, record.timestamp);
+    put(out, record.duration);
+    put(out, record.op);
+    put<uint8_t>(out, record.failed);
+    putString(out, record.path);
+    putString(out, record.target);
+    put(out, record.number);
+    put(out, record.dataLength);
+    put(out, record.dataSeed);
+}
+
+uint64_t Tracer::readHeader(istream &in) {
+    uint32_t magicNumber, version;
+    uint64_t blocks;
+    if (!get(in, magicNumber) || !get(in, version) || !get(in, blocks) || magicNumber != MAGIC_NUMBER) {
+        throw runtime_error("Not a BFS trace");
+    }
+    if (version != VERSION) {
+        throw runtime_error("Unsupported trace version " + to_string(version));
+    }
+    return blocks;
+}
+
+bool Tracer::read(istream &in, Record &record) {
+    uint8_t failed;
+    auto ok = get(in, record.timestamp) && get(in, record.duration) && get(in, record.op) && get(in, failed)
+              && getString(in, record.path) && getString(in, record.target)
+              && get(in, record.number) && get(in, record.dataLength) && get(in, record.dataSeed);
+    record.failed = failed;
+    return ok && record.op < Op::COUNT;
+}
+
+const char *Tracer::getName(Op op) {
+    const static char *names[] = {
+        "format", "mount", "sync", "su", "create", "cp", "mv", "rm", "stat",
+        "ls", "cd", "read", "write", "chown", "chmod", "df", "cp -r",
+        "snapshot create", "snapshot list", "snapshot delete", "export-tar", "import-tar", "du",
+    };
+    return names[static_cast<uint8_t>(op)];
+}
+
+string Tracer::makeData(uint32_t length, uint64_t seed) {
+    string data(length, '\0');
+    if (seed != 0) {
+        mt19937_64 random(seed);
+        for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+            auto value = random();
+            memcpy(&data[i], &value, min(sizeof(uint64_t), length - i));
+        }
+    }
+    return data;
+}
+
+Tracer::Scope::Scope(Tracer *tracer, Op op, const string &path, const string &target, uint32_t number)
+    : tracer(tracer), exceptions(uncaught_exceptions()), start(chrono::steady_clock::now()) {
+    if (tracer == nullptr) {
+        return;
+    }
+    nested = tracer->depth++ > 0;
+    record.timestamp = chrono::duration_cast<chrono::nanoseconds>(start - tracer->start).count();
+    record.op = op;
+    record.path = path;
+    record.target = target;
+    record.number = number;
+}
+
+Tracer::Scope::~Scope() {
+    if (tracer == nullptr) {
+        return;
+    }
+    tracer->depth--;
+    if (!nested) {
+        record.duration = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        record.failed = uncaught_exceptions() > exceptions;
+        tracer->write(record);
+    }
+}
+
+void Tracer::Scope::setData(const string &data) {
+    if (tracer == nullptr) {
+        return;
+    }
+    record.dataLength = data.length();
+    if (all_of(data.begin(), data.end(), [](char c) { return c == '\0'; })) {
+        record.dataSeed = 0;
+    } else {
+        record.dataSeed = hash<string>()(data) | 1; // never 0
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <string>
+#include <fstream>
+#include <chrono>
+
+using namespace std;
+
+/*
+ * Trace: [Header] [Record] [Record] ...
+ * Header: [magic] [version] [blocks]
+ *           4B       4B        8B
+ * Record: [timestamp] [duration] [op] [failed] [path] [target] [number] [dataLength] [dataSeed]
+ *             8B          8B      1B     1B      2B+n    2B+n      4B        4B           8B
+ * Written data is not kept, only its length and a seed to regenerate data of the same shape.
+ */
+class Tracer {
+public:
+    const static uint32_t MAGIC_NUMBER = 0x54534642; // "BFST"
+    const static uint32_t VERSION = 1;
+
+    enum class Op : uint8_t {
+        FORMAT,
+        MOUNT,
+        SYNC,
+        SET_UID,
+        CREATE,
+        COPY,
+        MOVE,
+        REMOVE,
+        STAT,
+        LIST,
+        CHANGE_DIRECTORY,
+        READ,
+        WRITE,
+        CHANGE_OWNER,
+        CHANGE_MODE,
+        STAT_SPACE,
+        COPY_TREE,
+        CREATE_SNAPSHOT,
+        LIST_SNAPSHOTS,
+        DELETE_SNAPSHOT,
+        EXPORT_TAR,
+        IMPORT_TAR,
+        DISK_USAGE,
+        COUNT,
+    };
+
+    struct Record {
+        uint64_t timestamp; // ns since the trace started
+        uint64_t duration; // ns spent in the call
+        Op op;
+        bool failed; // the call threw
+        string path;
+        string target;
+        uint32_t number; // uid, mode, block size of format, or 1 for a read-only mount
+        uint32_t dataLength;
+        uint64_t dataSeed; // 0 for all zeros
+    };
+
+    // records one public call of FileSystem, nested public calls are not recorded
+    class Scope {
+    private:
+        Tracer *tracer;
+        bool nested = false;
+        int exceptions;
+        Record record{};
+        chrono::steady_clock::time_point start;
+
+    public:
+        Scope(Tracer *tracer, Op op, const string &path = "", const string &target = "", uint32_t number = 0);
+
+        ~Scope();
+
+        void setData(const string &data);
+    };
+
+    Tracer(const string &path, uint64_t blocks);
+
+    ~Tracer();
+
+    void write(const Record &record);
+
+    static const char *getName(Op op);
+
+    static uint64_t readHeader(istream &in); // returns blocks of the traced disk
+
+    static bool read(istream &in, Record &record);
+
+    static string makeData(uint32_t length, uint64_t seed);
+
+private:
+    ofstream out;
+    int depth = 0;
+    chrono::steady_clock::time_point start;
+};
+
+#endif // _TRACE_H
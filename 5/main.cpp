@@ -4,6 +4,7 @@
 #include <functional>
 
 #include "core/fs.h"
+#include "core/stripedDisk.h"
 #include "utils/utils.h"
 
 const string &welcomeMessage = R"(
@@ -48,21 +49,132 @@ void printStat(const string &filename, FileSystem::InodeBase inode) {
          << filename << endl;
 }
 
+void printSpace(const FileSystem::SpaceInfo &info) {
+    auto usedBlocks = info.totalBlocks - info.freeBlocks;
+    auto usedInodes = info.totalInodes - info.freeInodes;
+    cout << "        " << setw(8) << "Total" << setw(8) << "Used" << setw(8) << "Free" << setw(8) << "Use%" << endl
+         << "Blocks  " << setw(8) << info.totalBlocks << setw(8) << usedBlocks << setw(8) << info.freeBlocks
+         << setw(7) << usedBlocks * 100 / info.totalBlocks << "%" << endl
+         << "Inodes  " << setw(8) << info.totalInodes << setw(8) << usedInodes << setw(8) << info.freeInodes
+         << setw(7) << usedInodes * 100 / info.totalInodes << "%" << endl
+         << "Size    " << setw(8) << Utils::formatSize((double) info.totalBlocks * info.blockSize).str()
+         << setw(8) << Utils::formatSize((double) usedBlocks * info.blockSize).str()
+         << setw(8) << Utils::formatSize((double) info.freeBlocks * info.blockSize).str() << endl;
+    for (size_t i = 0; i < info.groups.size(); i++) {
+        cout << "Group " << setw(2) << i << " " << setw(8) << info.groups[i].first << " free blocks"
+             << setw(8) << info.groups[i].second << " free inodes" << endl;
+    }
+    if (info.deduplication) {
+        cout << "Dedup   " << fixed << setprecision(2)
+             << (usedBlocks == 0 ? 1.0 : (double) (usedBlocks + info.savedBlocks) / usedBlocks) << "x, "
+             << info.savedBlocks << " blocks saved, " << info.lookups << " lookups, " << info.hits << " hits, "
+             << info.collisions << " collisions" << defaultfloat << endl;
+    }
+}
+
+void printCopy(const FileSystem::CopyInfo &info) {
+    cout << "Copied " << info.directories << " directories, " << info.files << " files, "
+         << Utils::formatSize(info.bytes).str() << " in " << fixed << setprecision(3) << info.seconds << "s ("
+         << Utils::formatSize(info.seconds > 0 ? info.bytes / info.seconds : 0).str() << "/s)" << defaultfloat;
+    if (info.sharedBlocks > 0) {
+        cout << ", " << info.sharedBlocks << " blocks shared";
+    }
+    cout << endl;
+}
+
+void printTar(ostream &out, const FileSystem::TarInfo &info) {
+    out << "Archived " << info.directories << " directories, " << info.files << " files, "
+        << Utils::formatSize(info.bytes).str() << " in " << fixed << setprecision(3) << info.seconds << "s ("
+        << Utils::formatSize(info.seconds > 0 ? info.bytes / info.seconds : 0).str() << "/s)" << defaultfloat;
+    if (info.skipped > 0) {
+        out << ", " << info.skipped << " entries skipped";
+    }
+    out << endl;
+}
+
+void printUsage(const vector<FileSystem::UsageInfo> &usages) {
+    for (const auto &usage: usages) {
+        cout << setw(8) << Utils::formatSize((double) usage.allocated).str()
+             << setw(8) << Utils::formatSize(usage.bytes).str() << setw(8) << usage.files << " " << usage.path << endl;
+    }
+}
+
+void exportTar(FileSystem &fs, const string &directory, const string &path) {
+    ofstream stream(path, ios::binary);
+    if (stream.fail()) {
+        throw runtime_error("Unable to open " + path);
+    }
+    printTar(cout, fs.exportTar(directory, stream));
+}
+
+void importTar(FileSystem &fs, const string &path, const string &directory) {
+    ifstream stream(path, ios::binary);
+    if (stream.fail()) {
+        throw runtime_error("Unable to open " + path);
+    }
+    printTar(cout, fs.importTar(stream, directory));
+}
+
+void printStats(const OperationStats &stats) {
+    auto &disk = stats.getDisk();
+    auto readLatency = disk.readLatency.summarize(), writeLatency = disk.writeLatency.summarize();
+    cout << left << setw(16) << "I/O" << right << setw(10) << "count" << setw(10) << "blocks" << setw(10) << "bytes"
+         << setw(10) << "p50(us)" << setw(10) << "p99(us)" << setw(10) << "max(us)" << endl << fixed << setprecision(1);
+    cout << left << setw(16) << "read" << right << setw(10) << disk.reads << setw(10) << disk.readBlocks
+         << setw(10) << Utils::formatSize(disk.readBytes).str() << setw(10) << readLatency.p50 / 1000.0
+         << setw(10) << readLatency.p99 / 1000.0 << setw(10) << readLatency.max / 1000.0 << endl;
+    cout << left << setw(16) << "write" << right << setw(10) << disk.writes << setw(10) << disk.writtenBlocks
+         << setw(10) << Utils::formatSize(disk.writtenBytes).str() << setw(10) << writeLatency.p50 / 1000.0
+         << setw(10) << writeLatency.p99 / 1000.0 << setw(10) << writeLatency.max / 1000.0 << endl;
+    cout << left << setw(16) << "discard" << right << setw(10) << disk.discards << setw(10) << disk.discardedBlocks
+         << endl;
+    cout << left << setw(16) << "Operation" << right << setw(10) << "calls" << setw(10) << "failed"
+         << setw(10) << "reads" << setw(10) << "writes" << setw(10) << "p50(us)" << setw(10) << "p99(us)"
+         << endl; // blocks per call
+    for (size_t i = 0; i < (size_t) Tracer::Op::COUNT; i++) {
+        auto &entry = stats.get((Tracer::Op) i);
+        if (entry.calls == 0) {
+            continue;
+        }
+        cout << left << setw(16) << Tracer::getName((Tracer::Op) i) << right << setw(10) << entry.calls
+             << setw(10) << entry.failures << setw(10) << (double) entry.readBlocks / entry.calls
+             << setw(10) << (double) entry.writtenBlocks / entry.calls
+             << setw(10) << entry.latency.percentile(0.5) / 1000.0
+             << setw(10) << entry.latency.percentile(0.99) / 1000.0 << endl;
+    }
+    cout << defaultfloat;
+}
+
+void printSnapshots(const vector<FileSystem::SnapshotInfo> &snapshots) {
+    for (const auto &snapshot: snapshots) {
+        cout << Utils::formatTimePoint(snapshot.creationTime) << " " << setw(8) << snapshot.blocks << " blocks"
+             << setw(6) << snapshot.copiedInodeBlocks << " inode blocks copied " << snapshot.name << endl;
+    }
+}
+
 void printHelp() {
     cout << "Commands:" << endl
-         << "    format" << endl
-         << "    mount" << endl
+         << "    format [4096|16384|65536] [dedup]" << endl
+         << "    mount [-r] [snapshot]" << endl
+         << "    snapshot <create|list|delete> [name]" << endl
+         << "    sync" << endl
+         << "    df" << endl
+         << "    discard <on|off>" << endl
+         << "    stats [reset|json [file_outside_bfs]]" << endl
          << "    store <file> <file_outside_bfs>" << endl
          << "    load <file_outside_bfs> <file>" << endl
+         << "    export-tar <directory> <tar_outside_bfs>" << endl
+         << "    import-tar <tar_outside_bfs> <directory>" << endl
          << "    touch <file>" << endl
          << "    mkdir <directory>" << endl
          << "    cd <directory>" << endl
          << "    ls [directory]" << endl
+         << "    du [directory]" << endl
          << "    stat <file>" << endl
          << "    cat <file>" << endl
          << "    write <file> <data>" << endl
          << "    mv <from> <to>" << endl
-         << "    cp <from> <to>" << endl
+         << "    cp [-r] <from> <to>" << endl
          << "    rm <file>" << endl
          << "    su <uid>" << endl
          << "    chown <uid> <file>" << endl
@@ -72,21 +184,102 @@ void printHelp() {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " <diskFilePath>" << endl;
+    vector<string> paths;
+    string tracePath;
+    string exportDirectory, importDirectory; // the archive is streamed through stdout or stdin instead of a REPL
+    auto stripeBlocks = StripedDisk::DEFAULT_STRIPE_BLOCKS;
+    for (auto i = 1; i < argc; i++) {
+        if (string(argv[i]) == "-s" && i + 1 < argc) {
+            stripeBlocks = stoul(argv[++i]);
+        } else if (string(argv[i]) == "-t" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (string(argv[i]) == "-e" && i + 1 < argc) {
+            exportDirectory = argv[++i];
+        } else if (string(argv[i]) == "-i" && i + 1 < argc) {
+            importDirectory = argv[++i];
+        } else {
+            paths.emplace_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        cerr << "Usage: " << argv[0] << " [-s <stripeBlocks>] [-t <traceFilePath>] [-e <directory> | -i <directory>]"
+             << " <diskFilePath> [<diskFilePath> ...]" << endl;
         return EXIT_FAILURE;
     }
 
-    Disk disk(argv[1]);
-    FileSystem fs(disk);
+    // several images are striped into one disk
+    auto disk = paths.size() == 1 ? make_unique<Disk>(paths[0].c_str()) : make_unique<StripedDisk>(paths, stripeBlocks);
+    // calls to fs are recorded for bfs_replay if a trace file is given
+    auto tracer = tracePath.empty() ? nullptr : make_unique<Tracer>(tracePath, disk->size());
+    FileSystem fs(*disk);
+    fs.setTracer(tracer.get());
+
+    if (!exportDirectory.empty() || !importDirectory.empty()) { // mount, stream the archive and leave
+        try {
+            fs.mount("", !exportDirectory.empty()); // an export may run while another process writes the image
+            auto info = exportDirectory.empty() ? fs.importTar(cin, importDirectory) : fs.exportTar(exportDirectory, cout);
+            fs.unmount();
+            printTar(cerr, info); // stdout may carry the archive
+        } catch (runtime_error &e) {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
 
     // map of functions is much more elegant than if-else/switch-case
     map<string, function<void(const string &, const string &)>> funcs = {
-        {"format",  [&fs](const string &, const string &) {
-            fs.format();
+        {"format",  [&fs](const string &blockSize, const string &option) {
+            if (!option.empty() && option != "dedup")
+                throw runtime_error("Usage: format [4096|16384|65536] [dedup]");
+            fs.format(blockSize.empty() ? Disk::BLOCK_SIZE : stoul(blockSize), option == "dedup");
         }},
-        {"mount",   [&fs](const string &, const string &) {
-            fs.mount();
+        {"mount",   [&fs](const string &option, const string &snapshot) {
+            if (option == "-r") { // other processes may keep writing the image
+                fs.mount(snapshot, true);
+            } else if (snapshot.empty()) {
+                fs.mount(option); // a snapshot is mounted read-only
+            } else {
+                throw runtime_error("Usage: mount [-r] [snapshot]");
+            }
+        }},
+        {"snapshot", [&fs](const string &action, const string &name) {
+            if (action == "create" && !name.empty()) {
+                fs.createSnapshot(name);
+            } else if (action == "list") {
+                printSnapshots(fs.listSnapshots());
+            } else if (action == "delete" && !name.empty()) {
+                fs.deleteSnapshot(name);
+            } else {
+                throw runtime_error("Usage: snapshot <create|list|delete> [name]");
+            }
+        }},
+        {"sync",    [&fs](const string &, const string &) {
+            fs.sync();
+        }},
+        {"df",      [&fs](const string &, const string &) {
+            printSpace(fs.statSpace());
+        }},
+        {"stats",   [&fs](const string &action, const string &path) {
+            if (action.empty()) {
+                printStats(fs.getStats());
+            } else if (action == "reset") {
+                fs.resetStats();
+            } else if (action == "json" && path.empty()) {
+                fs.getStats().dump(cout);
+            } else if (action == "json") {
+                ofstream stream(path);
+                if (stream.fail())
+                    throw runtime_error("Unable to open " + path);
+                fs.getStats().dump(stream);
+            } else {
+                throw runtime_error("Usage: stats [reset|json [file_outside_bfs]]");
+            }
+        }},
+        {"discard", [&fs](const string &state, const string &) {
+            if (state != "on" && state != "off")
+                throw runtime_error("Usage: discard <on|off>");
+            fs.setDiscard(state == "on");
         }},
         {"su",      [&fs](const string &uid, const string &) {
             if (uid.empty())
@@ -125,6 +318,16 @@ int main(int argc, char *argv[]) {
                 throw runtime_error("Usage: load <file_outside_bfs> <file>");
             load(fs, from, to);
         }},
+        {"export-tar", [&fs](const string &directory, const string &path) {
+            if (directory.empty() || path.empty())
+                throw runtime_error("Usage: export-tar <directory> <tar_outside_bfs>");
+            exportTar(fs, directory, path);
+        }},
+        {"import-tar", [&fs](const string &path, const string &directory) {
+            if (path.empty() || directory.empty())
+                throw runtime_error("Usage: import-tar <tar_outside_bfs> <directory>");
+            importTar(fs, path, directory);
+        }},
         {"touch",   [&fs](const string &file, const string &) {
             if (file.empty())
                 throw runtime_error("Usage: touch <file>");
@@ -141,6 +344,9 @@ int main(int argc, char *argv[]) {
             for (const auto &[filename, inode]: fs.listDirectory(directory))
                 printStat(filename, inode);
         }},
+        {"du",      [&fs](const string &directory, const string &) {
+            printUsage(fs.diskUsage(directory.empty() ? "." : directory));
+        }},
         {"cd",      [&fs](const string &directory, const string &) {
             if (directory.empty())
                 throw runtime_error("Usage: cd <directory>");
@@ -167,14 +373,28 @@ int main(int argc, char *argv[]) {
             fs.moveFile(from, to);
         }},
         {"cp",      [&fs](const string &from, const string &to) {
+            if (from == "-r") {
+                istringstream iss(to);
+                string source, target;
+                iss >> source >> target;
+                if (source.empty() || target.empty())
+                    throw runtime_error("Usage: cp -r <from> <to>");
+                printCopy(fs.copyTree(source, target));
+                return;
+            }
             if (from.empty() || to.empty())
-                throw runtime_error("Usage: cp <from> <to>");
+                throw runtime_error("Usage: cp [-r] <from> <to>");
             fs.copyFile(from, to);
         }},
         {"help",    [&fs](const string &, const string &) {
             printHelp();
         }},
-        {"exit",    [&fs](const string &, const string &) {
+        {"exit",    [&fs, &disk, &tracer](const string &, const string &) {
+            if (disk->mounted()) {
+                fs.unmount(); // exit() skips the destructor of fs
+            }
+            fs.setTracer(nullptr);
+            tracer.reset(); // and of tracer, which flushes the trace
             exit(EXIT_SUCCESS);
         }},
         {"default", [&fs](const string &cmd, const string &) {
@@ -0,0 +1,190 @@
+#include <iostream>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+
+#include "core/fs.h"
+#include "utils/utils.h"
+
+// replays a trace recorded by `bfs -t` on a fresh image and reports latency of every kind of operation
+
+class DiscardBuffer : public streambuf { // archives of exports are produced but not kept
+protected:
+    int overflow(int c) override { return c; }
+
+    streamsize xsputn(const char *, streamsize n) override { return n; }
+};
+
+void replay(FileSystem &fs, const Tracer::Record &record, bool deduplication) {
+    using Op = Tracer::Op;
+    switch (record.op) {
+        case Op::FORMAT:
+            fs.format(record.number ? record.number : Disk::BLOCK_SIZE, deduplication || record.target == "dedup");
+            break;
+        case Op::SYNC:
+            fs.sync();
+            break;
+        case Op::SET_UID:
+            fs.setUid(record.number);
+            break;
+        case Op::CREATE:
+            fs.createFile(record.path);
+            break;
+        case Op::COPY:
+            fs.copyFile(record.path, record.target);
+            break;
+        case Op::MOVE:
+            fs.moveFile(record.path, record.target);
+            break;
+        case Op::REMOVE:
+            fs.removeFile(record.path);
+            break;
+        case Op::STAT:
+            fs.statFile(record.path);
+            break;
+        case Op::LIST:
+            fs.listDirectory(record.path);
+            break;
+        case Op::CHANGE_DIRECTORY:
+            fs.changeDirectory(record.path);
+            break;
+        case Op::READ:
+            fs.readFile(record.path);
+            break;
+        case Op::WRITE:
+            fs.writeFile(record.path, Tracer::makeData(record.dataLength, record.dataSeed));
+            break;
+        case Op::CHANGE_OWNER:
+            fs.changeOwner(record.path, record.number);
+            break;
+        case Op::CHANGE_MODE:
+            fs.changeMode(record.path, static_cast<Permissions>(record.number));
+            break;
+        case Op::STAT_SPACE:
+            fs.statSpace();
+            break;
+        case Op::COPY_TREE:
+            fs.copyTree(record.path, record.target);
+            break;
+        case Op::CREATE_SNAPSHOT:
+            fs.createSnapshot(record.path);
+            break;
+        case Op::LIST_SNAPSHOTS:
+            fs.listSnapshots();
+            break;
+        case Op::DELETE_SNAPSHOT:
+            fs.deleteSnapshot(record.path);
+            break;
+        case Op::EXPORT_TAR: {
+            DiscardBuffer buffer;
+            ostream archive(&buffer);
+            fs.exportTar(record.path, archive);
+            break;
+        }
+        case Op::DISK_USAGE:
+            fs.diskUsage(record.path);
+            break;
+        default: // the fresh image is mounted already, archives of imports are not recorded
+            break;
+    }
+}
+
+double percentile(const vector<uint64_t> &sorted, double p) {
+    return sorted[min(sorted.size() - 1, (size_t) (p * sorted.size()))] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <traceFilePath> <diskFilePath> [--timing] [--dedup] [--stats <jsonFilePath>]" << endl;
+        return EXIT_FAILURE;
+    }
+    auto timing = false; // keep the original pace instead of full speed
+    auto deduplication = false; // format with deduplication even if the original did not, to measure its cost
+    string statsPath; // I/O statistics are dumped as JSON for comparing runs
+    for (auto i = 3; i < argc; i++) {
+        timing |= string(argv[i]) == "--timing";
+        deduplication |= string(argv[i]) == "--dedup";
+        if (string(argv[i]) == "--stats" && i + 1 < argc) {
+            statsPath = argv[++i];
+        }
+    }
+
+    ifstream trace(argv[1], ios::binary);
+    if (trace.fail()) {
+        cerr << "Unable to open " << argv[1] << endl;
+        return EXIT_FAILURE;
+    }
+    map<Tracer::Op, vector<uint64_t>> latencies;
+    map<Tracer::Op, pair<double, double>> amplification; // blocks read and written per call
+    size_t diverged = 0; // calls whose success differs from the original
+    FileSystem::SpaceInfo space{};
+    try {
+        auto blocks = Tracer::readHeader(trace);
+        { // a fresh image of the traced size
+            ofstream image(argv[2], ios::binary | ios::trunc);
+        }
+        filesystem::resize_file(argv[2], blocks * Disk::BLOCK_SIZE);
+        Disk disk(argv[2]);
+        FileSystem fs(disk);
+        fs.format(Disk::BLOCK_SIZE, deduplication);
+
+        Tracer::Record record;
+        auto start = chrono::steady_clock::now();
+        while (Tracer::read(trace, record)) {
+            if (timing) {
+                this_thread::sleep_until(start + chrono::nanoseconds(record.timestamp));
+            }
+            auto failed = false;
+            auto begin = chrono::steady_clock::now();
+            try {
+                replay(fs, record, deduplication);
+            } catch (runtime_error &) {
+                failed = true;
+            }
+            auto end = chrono::steady_clock::now();
+            latencies[record.op].push_back(chrono::duration_cast<chrono::nanoseconds>(end - begin).count());
+            diverged += failed != record.failed;
+        }
+        fs.sync();
+        space = fs.statSpace();
+        fs.unmount();
+        for (auto &[op, samples]: latencies) {
+            auto &entry = fs.getStats().get(op);
+            auto calls = (double) max(entry.calls, (uint64_t) 1); // replayed ops like mount are not called
+            amplification[op] = {entry.readBlocks / calls, entry.writtenBlocks / calls};
+        }
+        if (!statsPath.empty()) {
+            ofstream stats(statsPath);
+            if (stats.fail()) {
+                throw runtime_error("Unable to open " + statsPath);
+            }
+            fs.getStats().dump(stats);
+        }
+    } catch (runtime_error &e) {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    cout << left << setw(16) << "op" << right << setw(10) << "count"
+         << setw(12) << "p50(us)" << setw(12) << "p90(us)" << setw(12) << "p99(us)" << setw(12) << "max(us)"
+         << setw(10) << "reads" << setw(10) << "writes" << endl; // blocks per call
+    cout << fixed << setprecision(1);
+    for (auto &[op, samples]: latencies) {
+        sort(samples.begin(), samples.end());
+        cout << left << setw(16) << Tracer::getName(op) << right << setw(10) << samples.size()
+             << setw(12) << percentile(samples, 0.5) << setw(12) << percentile(samples, 0.9)
+             << setw(12) << percentile(samples, 0.99) << setw(12) << samples.back() / 1000.0
+             << setw(10) << amplification[op].first << setw(10) << amplification[op].second << endl;
+    }
+    cout << diverged << " calls diverged from the original outcome" << endl;
+    if (space.deduplication) {
+        auto usedBlocks = space.totalBlocks - space.freeBlocks;
+        cout << "dedup ratio " << setprecision(2)
+             << (usedBlocks == 0 ? 1.0 : (double) (usedBlocks + space.savedBlocks) / usedBlocks) << "x, "
+             << space.savedBlocks << " blocks saved, " << space.hits << "/" << space.lookups << " lookups hit, "
+             << space.collisions << " collisions" << endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -27,6 +27,18 @@ stringstream Utils::formatSize(double originalSize) {
     return ss;
 }
 
+string_view Utils::nextPart(string_view &path) {
+    while (!path.empty()) {
+        auto slash = path.find('/');
+        auto part = path.substr(0, slash);
+        path.remove_prefix(slash == string_view::npos ? path.size() : slash + 1);
+        if (!part.empty()) {
+            return part;
+        }
+    }
+    return {};
+}
+
 vector<string> Utils::split(const string &str, const string &delimiter) {
     vector<string> tokens;
     size_t prev = 0, pos;
@@ -5,6 +5,7 @@
 #include <chrono>
 #include <iomanip>
 #include <vector>
+#include <string_view>
 
 #define KB              1000
 #define MB              1000000
@@ -16,6 +17,9 @@ using namespace std;
 struct Utils {
     static vector<string> split(const string &str, const string &delimiter);
 
+    // takes the next non-empty component of a path off its front, empty if there is none, without copying
+    static string_view nextPart(string_view &path);
+
     static _Put_time<char> formatTimePoint(uint32_t timePoint);
 
     static stringstream formatSize(double originalSize);